@@ -27,6 +27,7 @@
 #include <linux/sched.h>
 #include <linux/async.h>
 #include <linux/suspend.h>
+#include <linux/suspend_time.h>
 #include <linux/timer.h>
 
 #include "../base.h"
@@ -187,6 +188,17 @@ static void initcall_debug_report(struct device *dev, ktime_t calltime,
 	}
 }
 
+static enum suspend_time_phase dpm_time_phase(pm_message_t state, bool noirq)
+{
+	bool resume = state.event & (PM_EVENT_RESUME | PM_EVENT_THAW |
+				     PM_EVENT_RESTORE | PM_EVENT_RECOVER);
+
+	if (noirq)
+		return resume ? SUSPEND_PHASE_DPM_RESUME_NOIRQ :
+				SUSPEND_PHASE_DPM_SUSPEND_NOIRQ;
+	return resume ? SUSPEND_PHASE_DPM_RESUME : SUSPEND_PHASE_DPM_SUSPEND;
+}
+
 /**
  * dpm_wait - Wait for a PM operation to complete.
  * @dev: Device to wait for.
@@ -224,6 +236,7 @@ static int pm_op(struct device *dev,
 {
 	int error = 0;
 	ktime_t calltime;
+	u64 start = suspend_time_now();
 
 	calltime = initcall_debug_start(dev);
 
@@ -275,6 +288,7 @@ static int pm_op(struct device *dev,
 	}
 
 	initcall_debug_report(dev, calltime, error);
+	suspend_time_device(dev, dpm_time_phase(state, false), start, error);
 
 	return error;
 }
@@ -294,6 +308,7 @@ static int pm_noirq_op(struct device *dev,
 {
 	int error = 0;
 	ktime_t calltime = ktime_set(0, 0), delta, rettime;
+	u64 start = suspend_time_now();
 
 	if (initcall_debug) {
 		pr_info("calling  %s+ @ %i, parent: %s\n",
@@ -356,6 +371,7 @@ static int pm_noirq_op(struct device *dev,
 			dev_name(dev), error,
 			(unsigned long long)ktime_to_ns(delta) >> 10);
 	}
+	suspend_time_device(dev, dpm_time_phase(state, true), start, error);
 
 	return error;
 }
@@ -492,6 +508,7 @@ static int legacy_resume(struct device *dev, int (*cb)(struct device *dev))
 {
 	int error;
 	ktime_t calltime;
+	u64 start = suspend_time_now();
 
 	calltime = initcall_debug_start(dev);
 
@@ -499,6 +516,7 @@ static int legacy_resume(struct device *dev, int (*cb)(struct device *dev))
 	suspend_report_result(cb, error);
 
 	initcall_debug_report(dev, calltime, error);
+	suspend_time_device(dev, SUSPEND_PHASE_DPM_RESUME, start, error);
 
 	return error;
 }
@@ -860,6 +878,7 @@ static int legacy_suspend(struct device *dev, pm_message_t state,
 {
 	int error;
 	ktime_t calltime;
+	u64 start = suspend_time_now();
 
 	calltime = initcall_debug_start(dev);
 
@@ -867,6 +886,7 @@ static int legacy_suspend(struct device *dev, pm_message_t state,
 	suspend_report_result(cb, error);
 
 	initcall_debug_report(dev, calltime, error);
+	suspend_time_device(dev, SUSPEND_PHASE_DPM_SUSPEND, start, error);
 
 	return error;
 }
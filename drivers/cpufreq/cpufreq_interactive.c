@@ -19,7 +19,9 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/input.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/tick.h>
 #include <linux/timer.h>
@@ -91,6 +93,24 @@ static unsigned long min_sample_time;
 #define DEFAULT_TIMER_RATE 20000;
 static unsigned long timer_rate;
 
+/* Frequency to boost to on input events and boostpulse; if 0 - max speed */
+static unsigned long boost_freq;
+
+/* How long a boost lasts, in usecs */
+#define DEFAULT_BOOST_DURATION 80000
+static unsigned long boost_duration;
+
+/* Boost on touch and key events */
+static unsigned long input_boost = 1;
+
+/* Boost window, in usecs of ktime_get(), and its statistics */
+static DEFINE_SPINLOCK(boost_lock);
+static u64 boost_start_time;
+static u64 boost_end_time;
+static unsigned long boost_count;
+static u64 boost_time;
+static struct timer_list boost_timer;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -104,6 +124,28 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+/*
+ * While a boost is running the policy is held at or above the boost
+ * frequency, whatever the per-cpu targets say.
+ */
+static unsigned int cpufreq_interactive_boost_floor(
+	struct cpufreq_policy *policy)
+{
+	u64 now = ktime_to_us(ktime_get());
+	unsigned long flags;
+	int boosted;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	boosted = now < boost_end_time;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	if (!boosted)
+		return 0;
+	if (!boost_freq || boost_freq > policy->max)
+		return policy->max;
+	return boost_freq;
+}
+
 static unsigned int cpufreq_interactive_get_target(
 	int cpu_load, int load_since_change, struct cpufreq_policy *policy)
 {
@@ -445,6 +487,8 @@ static int cpufreq_interactive_up_task(void *data)
 					max_freq = pjcpu->target_freq;
 			}
 
+			max_freq = max(max_freq,
+				cpufreq_interactive_boost_floor(pcpu->policy));
 			__cpufreq_driver_target(pcpu->policy,
 						max_freq,
 						CPUFREQ_RELATION_H);
@@ -493,6 +537,8 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 				max_freq = pjcpu->target_freq;
 		}
 
+		max_freq = max(max_freq,
+			       cpufreq_interactive_boost_floor(pcpu->policy));
 		__cpufreq_driver_target(pcpu->policy, max_freq,
 					CPUFREQ_RELATION_H);
 
@@ -505,6 +551,143 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 	}
 }
 
+/*
+ * Raise every policy to the boost frequency right away instead of waiting
+ * for the next load sample.  Safe to call from atomic context.
+ */
+static void cpufreq_interactive_boost(void)
+{
+	u64 now = ktime_to_us(ktime_get());
+	unsigned long flags;
+	unsigned int cpu;
+	int extend;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	extend = now < boost_end_time;
+	if (!extend) {
+		boost_time += boost_end_time - boost_start_time;
+		boost_start_time = now;
+		boost_count++;
+	}
+	boost_end_time = now + boost_duration;
+	spin_unlock_irqrestore(&boost_lock, flags);
+
+	mod_timer(&boost_timer, jiffies + usecs_to_jiffies(boost_duration) + 1);
+
+	/* Already at the boost frequency, the new end time is enough */
+	if (extend)
+		return;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	for_each_online_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+
+		smp_rmb();
+		if (pcpu->governor_enabled)
+			cpumask_set_cpu(pcpu->policy->cpu, &up_cpumask);
+	}
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+	wake_up_process(up_task);
+}
+
+/* Boost is over, let the per-cpu targets bring the speed back down */
+static void cpufreq_interactive_boost_end(unsigned long data)
+{
+	unsigned long flags;
+	unsigned int cpu;
+
+	spin_lock_irqsave(&down_cpumask_lock, flags);
+	for_each_online_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+
+		smp_rmb();
+		if (pcpu->governor_enabled)
+			cpumask_set_cpu(pcpu->policy->cpu, &down_cpumask);
+	}
+	spin_unlock_irqrestore(&down_cpumask_lock, flags);
+	queue_work(down_wq, &freq_scale_down_work);
+}
+
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	if (!input_boost || !atomic_read(&active_count))
+		return;
+
+	/* Key presses, and any movement on a touch device */
+	if ((type == EV_KEY && value) || (type == EV_ABS && handle->private))
+		cpufreq_interactive_boost();
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	int ret;
+	struct input_handle *handle;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+	/* Only touch devices boost on EV_ABS, not sensors */
+	if (test_bit(ABS_MT_POSITION_X, dev->absbit) ||
+	    test_bit(BTN_TOUCH, dev->keybit))
+		handle->private = handle;
+
+	ret = input_register_handle(handle);
+	if (ret)
+		goto err_input_register_handle;
+
+	ret = input_open_device(handle);
+	if (ret)
+		goto err_input_open_device;
+
+	return 0;
+
+err_input_open_device:
+	input_unregister_handle(handle);
+err_input_register_handle:
+	kfree(handle);
+	return ret;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_input_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_input_ids,
+};
+
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
@@ -655,6 +838,108 @@ static ssize_t store_timer_rate(struct kobject *kobj,
 static struct global_attr timer_rate_attr = __ATTR(timer_rate, 0644,
 		show_timer_rate, store_timer_rate);
 
+static ssize_t show_boost_freq(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost_freq);
+}
+
+static ssize_t store_boost_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	boost_freq = val;
+	return count;
+}
+
+static struct global_attr boost_freq_attr = __ATTR(boost_freq, 0644,
+		show_boost_freq, store_boost_freq);
+
+static ssize_t show_boost_duration(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost_duration);
+}
+
+static ssize_t store_boost_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	boost_duration = val;
+	return count;
+}
+
+static struct global_attr boost_duration_attr = __ATTR(boost_duration, 0644,
+		show_boost_duration, store_boost_duration);
+
+static ssize_t show_input_boost(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost);
+}
+
+static ssize_t store_input_boost(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	input_boost = val;
+	return count;
+}
+
+static struct global_attr input_boost_attr = __ATTR(input_boost, 0644,
+		show_input_boost, store_input_boost);
+
+static ssize_t store_boostpulse(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	cpufreq_interactive_boost();
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
+static ssize_t show_boost_count(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost_count);
+}
+
+static struct global_attr boost_count_attr = __ATTR(boost_count, 0444,
+		show_boost_count, NULL);
+
+/* Total time spent boosted, in usecs, including a boost still running */
+static ssize_t show_boost_time(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	u64 now = ktime_to_us(ktime_get());
+	unsigned long flags;
+	u64 total;
+
+	spin_lock_irqsave(&boost_lock, flags);
+	total = boost_time + min(now, boost_end_time) - boost_start_time;
+	spin_unlock_irqrestore(&boost_lock, flags);
+	return sprintf(buf, "%llu\n", total);
+}
+
+static struct global_attr boost_time_attr = __ATTR(boost_time, 0444,
+		show_boost_time, NULL);
+
 static struct attribute *interactive_attributes[] = {
 	&go_maxspeed_load_attr.attr,
 	&boost_factor_attr.attr,
@@ -663,6 +948,12 @@ static struct attribute *interactive_attributes[] = {
 	&sustain_load_attr.attr,
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
+	&boost_freq_attr.attr,
+	&boost_duration_attr.attr,
+	&input_boost_attr.attr,
+	&boostpulse_attr.attr,
+	&boost_count_attr.attr,
+	&boost_time_attr.attr,
 	NULL,
 };
 
@@ -780,15 +1071,19 @@ static struct notifier_block cpufreq_interactive_idle_nb = {
 	.notifier_call = cpufreq_interactive_idle_notifier,
 };
 
+static bool input_boost_registered;
+
 static int __init cpufreq_interactive_init(void)
 {
 	unsigned int i;
+	int rc;
 	struct cpufreq_interactive_cpuinfo *pcpu;
 	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
 	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
 	timer_rate = DEFAULT_TIMER_RATE;
+	boost_duration = DEFAULT_BOOST_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -820,9 +1115,30 @@ static int __init cpufreq_interactive_init(void)
 	spin_lock_init(&down_cpumask_lock);
 	mutex_init(&set_speed_lock);
 
+	setup_timer(&boost_timer, cpufreq_interactive_boost_end, 0);
+
 	idle_notifier_register(&cpufreq_interactive_idle_nb);
 
-	return cpufreq_register_governor(&cpufreq_gov_interactive);
+	if (input_register_handler(&cpufreq_interactive_input_handler))
+		pr_warn("cpufreq_interactive: no input boost\n");
+	else
+		input_boost_registered = true;
+
+	rc = cpufreq_register_governor(&cpufreq_gov_interactive);
+	if (rc)
+		goto err_unregister;
+	return 0;
+
+err_unregister:
+	if (input_boost_registered)
+		input_unregister_handler(&cpufreq_interactive_input_handler);
+	input_boost_registered = false;
+	idle_notifier_unregister(&cpufreq_interactive_idle_nb);
+	del_timer_sync(&boost_timer);
+	destroy_workqueue(down_wq);
+	kthread_stop(up_task);
+	put_task_struct(up_task);
+	return rc;
 
 err_freeuptask:
 	put_task_struct(up_task);
@@ -838,6 +1154,9 @@ module_init(cpufreq_interactive_init);
 static void __exit cpufreq_interactive_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	if (input_boost_registered)
+		input_unregister_handler(&cpufreq_interactive_input_handler);
+	del_timer_sync(&boost_timer);
 	kthread_stop(up_task);
 	put_task_struct(up_task);
 	destroy_workqueue(down_wq);
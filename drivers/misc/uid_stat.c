@@ -13,42 +13,58 @@
  *
  */
 
-#include <asm/atomic.h>
-
 #include <linux/err.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/proc_fs.h>
+#include <linux/rculist.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
 #include <linux/stat.h>
 #include <linux/uid_stat.h>
 #include <net/activity_stats.h>
 
-static DEFINE_SPINLOCK(uid_lock);
-static LIST_HEAD(uid_list);
+#define UID_HASH_BITS	8
+
+/*
+ * Entries are looked up under RCU on every send and receive, and only
+ * added, never removed; uid_lock serializes adding them.
+ */
+static DEFINE_MUTEX(uid_lock);
+static struct hlist_head uid_hash[1 << UID_HASH_BITS];
 static struct proc_dir_entry *parent;
 
+/*
+ * Byte counts wrap at 4GB, and are only summed over cpus when read from
+ * proc.
+ */
+struct uid_stat_cpu {
+	unsigned int tcp_rcv;
+	unsigned int tcp_snd;
+};
+
 struct uid_stat {
-	struct list_head link;
+	struct hlist_node link;
 	uid_t uid;
-	atomic_t tcp_rcv;
-	atomic_t tcp_snd;
+	struct uid_stat_cpu __percpu *stats;
 };
 
 static struct uid_stat *find_uid_stat(uid_t uid) {
-	unsigned long flags;
+	struct hlist_head *head = &uid_hash[hash_32(uid, UID_HASH_BITS)];
+	struct hlist_node *node;
 	struct uid_stat *entry;
 
-	spin_lock_irqsave(&uid_lock, flags);
-	list_for_each_entry(entry, &uid_list, link) {
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(entry, node, head, link) {
 		if (entry->uid == uid) {
-			spin_unlock_irqrestore(&uid_lock, flags);
+			rcu_read_unlock();
 			return entry;
 		}
 	}
-	spin_unlock_irqrestore(&uid_lock, flags);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -56,13 +72,16 @@ static int tcp_snd_read_proc(char *page, char **start, off_t off,
 				int count, int *eof, void *data)
 {
 	int len;
+	int cpu;
 	unsigned int bytes;
 	char *p = page;
 	struct uid_stat *uid_entry = (struct uid_stat *) data;
 	if (!data)
 		return 0;
 
-	bytes = (unsigned int) (atomic_read(&uid_entry->tcp_snd) + INT_MIN);
+	bytes = 0;
+	for_each_possible_cpu(cpu)
+		bytes += per_cpu_ptr(uid_entry->stats, cpu)->tcp_snd;
 	p += sprintf(p, "%u\n", bytes);
 	len = (p - page) - off;
 	*eof = (len <= count) ? 1 : 0;
@@ -74,13 +93,16 @@ static int tcp_rcv_read_proc(char *page, char **start, off_t off,
 				int count, int *eof, void *data)
 {
 	int len;
+	int cpu;
 	unsigned int bytes;
 	char *p = page;
 	struct uid_stat *uid_entry = (struct uid_stat *) data;
 	if (!data)
 		return 0;
 
-	bytes = (unsigned int) (atomic_read(&uid_entry->tcp_rcv) + INT_MIN);
+	bytes = 0;
+	for_each_possible_cpu(cpu)
+		bytes += per_cpu_ptr(uid_entry->stats, cpu)->tcp_rcv;
 	p += sprintf(p, "%u\n", bytes);
 	len = (p - page) - off;
 	*eof = (len <= count) ? 1 : 0;
@@ -90,23 +112,33 @@ static int tcp_rcv_read_proc(char *page, char **start, off_t off,
 
 /* Create a new entry for tracking the specified uid. */
 static struct uid_stat *create_stat(uid_t uid) {
-	unsigned long flags;
 	char uid_s[32];
 	struct uid_stat *new_uid;
 	struct proc_dir_entry *entry;
 
-	/* Create the uid stat struct and append it to the list. */
+	mutex_lock(&uid_lock);
+
+	/* Another task may have added it since we looked. */
+	new_uid = find_uid_stat(uid);
+	if (new_uid) {
+		mutex_unlock(&uid_lock);
+		return new_uid;
+	}
+
+	/* Create the uid stat struct and add it to the hash. */
 	if ((new_uid = kmalloc(sizeof(struct uid_stat), GFP_KERNEL)) == NULL)
-		return NULL;
+		goto fail;
 
 	new_uid->uid = uid;
-	/* Counters start at INT_MIN, so we can track 4GB of network traffic. */
-	atomic_set(&new_uid->tcp_rcv, INT_MIN);
-	atomic_set(&new_uid->tcp_snd, INT_MIN);
+	new_uid->stats = alloc_percpu(struct uid_stat_cpu);
+	if (!new_uid->stats) {
+		kfree(new_uid);
+		goto fail;
+	}
 
-	spin_lock_irqsave(&uid_lock, flags);
-	list_add_tail(&new_uid->link, &uid_list);
-	spin_unlock_irqrestore(&uid_lock, flags);
+	hlist_add_head_rcu(&new_uid->link,
+			   &uid_hash[hash_32(uid, UID_HASH_BITS)]);
+	mutex_unlock(&uid_lock);
 
 	sprintf(uid_s, "%d", uid);
 	entry = proc_mkdir(uid_s, parent);
@@ -119,6 +151,10 @@ static struct uid_stat *create_stat(uid_t uid) {
 		(void *) new_uid);
 
 	return new_uid;
+
+fail:
+	mutex_unlock(&uid_lock);
+	return NULL;
 }
 
 int uid_stat_tcp_snd(uid_t uid, int size) {
@@ -128,7 +164,7 @@ int uid_stat_tcp_snd(uid_t uid, int size) {
 		((entry = create_stat(uid)) == NULL)) {
 			return -1;
 	}
-	atomic_add(size, &entry->tcp_snd);
+	this_cpu_add(entry->stats->tcp_snd, size);
 	return 0;
 }
 
@@ -139,7 +175,7 @@ int uid_stat_tcp_rcv(uid_t uid, int size) {
 		((entry = create_stat(uid)) == NULL)) {
 			return -1;
 	}
-	atomic_add(size, &entry->tcp_rcv);
+	this_cpu_add(entry->stats->tcp_rcv, size);
 	return 0;
 }
 
@@ -25,6 +25,11 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,17 +38,33 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Positions in the log are free-running byte counts, mapped into the buffer
+ * by logger_offset(). Writers take no lock: each claims its bytes by
+ * advancing 'reserve' with cmpxchg, then, in the order they claimed them,
+ * pull 'head' past the entries they are about to overwrite ('fixed'), copy
+ * their entry in parallel, and publish it ('commit'). Readers never stop
+ * writers; they check 'head' after copying an entry and retry if they were
+ * lapped in the meantime. Readers that mmap the log follow the same protocol
+ * through 'info', which mirrors the positions.
+ *
+ * Positions wrap every 4 GB, so they are only compared within a window
+ * of the log: 'flushed' is pulled along with 'head', and readers that
+ * were idle while head moved on by more than that are sent back to head
+ * by counting 'laps'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	unsigned long		reserve; /* next position handed to a writer */
+	unsigned long		fixed;	/* head is valid up to here */
+	unsigned long		commit;	/* entries before here are complete */
+	unsigned long		head;	/* oldest entry not yet overwritten */
+	unsigned long		flushed; /* new readers start at or after here */
+	unsigned long		laps;	/* LOGGER_LAP boundaries head crossed */
+	struct logger_mmap_info	*info;	/* page mapped by readers, or NULL */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,17 +72,29 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. r_pos is protected by 'mutex', which only keeps
+ * concurrent reads of the same file apart.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads of this file */
+	unsigned long		r_pos;	/* current read position */
+	unsigned long		r_laps;	/* log->laps when r_pos was set */
+	int			mode;	/* LOGGER_READ_ENTRY or _BATCH */
 };
 
+/* much larger than any log, and divides the range of the positions */
+#define LOGGER_LAP_SHIFT	30
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/*
+ * Log lines up to this long are staged on the writer's stack, longer ones
+ * in a kmalloc'ed buffer.
+ */
+#define LOGGER_STAGE_LEN	256
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -89,7 +122,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Readers must check they were not lapped before trusting the result.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,16 +141,60 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * reader_pos - returns the position 'reader' reads from next, pulled forward
+ * to the oldest readable entry if it was lapped or flushed, and stores the
+ * current commit position in 'commit'.
+ *
+ * Distances are measured back from 'commit', so this is safe against the
+ * positions wrapping, as long as r_pos is less than 4 GB behind. A reader
+ * that head passed two LOGGER_LAP boundaries away from is far behind the
+ * log either way, and starts over at head.
+ */
+static unsigned long reader_pos(struct logger_log *log,
+				struct logger_reader *reader,
+				unsigned long *commit)
+{
+	unsigned long laps = ACCESS_ONCE(log->laps);
+	unsigned long head = ACCESS_ONCE(log->head);
+	unsigned long flushed = ACCESS_ONCE(log->flushed);
+	unsigned long pos = reader->r_pos;
+	unsigned long end;
+
+	/* head and flushed never pass the commit position read after them */
+	smp_rmb();
+	end = ACCESS_ONCE(log->commit);
+	*commit = end;
+	/* and entries before commit are complete */
+	smp_rmb();
+
+	if (end - flushed < end - head)
+		head = flushed;
+	if (laps - reader->r_laps >= 2 || end - pos > end - head)
+		pos = head;
+
+	return pos;
+}
+
+/*
+ * reader_lapped - did a writer overwrite the entry at 'pos' since the caller
+ * read it? Writers move head past an entry before they overwrite it.
+ */
+static inline int reader_lapped(struct logger_log *log, unsigned long pos)
+{
+	smp_rmb();
+	return (long)(ACCESS_ONCE(log->head) - pos) > 0;
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes from position 'pos' of
+ * 'log' into the user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * The caller must check for having been lapped afterwards.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log_to_user(struct logger_log *log, unsigned long pos,
+				   char __user *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
 	/*
@@ -125,8 +202,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +214,32 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+/*
+ * get_batch_len - returns the length of the entries starting at 'pos' and
+ * ending before 'commit' that fit whole into 'count' bytes, or of the first
+ * entry if even that does not fit.
+ *
+ * Readers must check they were not lapped before trusting the result.
+ */
+static size_t get_batch_len(struct logger_log *log, unsigned long pos,
+			    unsigned long commit, size_t count)
+{
+	size_t len = get_entry_len(log, logger_offset(pos));
+
+	while (commit - pos > len) {
+		size_t nr = get_entry_len(log, logger_offset(pos + len));
+
+		if (len + nr > count)
+			break;
+		len += nr;
+	}
+
+	return len;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -149,16 +247,18 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH mode
+ * 	  as many whole entries as fit in the buffer
  *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN, or more in batch mode. Will set
+ * errno to EINVAL if read buffer is insufficient to hold next entry.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
-			   size_t count, loff_t *pos)
+			   size_t count, loff_t *ppos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	unsigned long pos, commit;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -166,9 +266,8 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		pos = reader_pos(log, reader, &commit);
+		ret = (pos == commit);
 		if (!ret)
 			break;
 
@@ -189,145 +288,165 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
 
+retry:
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	pos = reader_pos(log, reader, &commit);
+	if (unlikely(pos == commit)) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
+	/* get the size of the next entry, or entries */
+	if (reader->mode == LOGGER_READ_BATCH)
+		ret = get_batch_len(log, pos, commit, count);
+	else
+		ret = get_entry_len(log, logger_offset(pos));
+	if (reader_lapped(log, pos))
+		goto retry;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* get exactly those entries from the log */
+	ret = do_read_log_to_user(log, pos, buf, ret);
+	if (reader_lapped(log, pos))
+		goto retry;
+	if (ret > 0) {
+		reader->r_pos = pos + ret;
+		reader->r_laps = ACCESS_ONCE(log->laps);
+	}
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * fix_up_head - pull the log's head forward to the first entry at or after
+ * 'end' minus the log size, which a writer reserving up to 'end' leaves
+ * intact. Readers behind the new head notice they were lapped and skip to
+ * it; see reader_pos().
  *
- * Caller must hold log->mutex.
+ * Writers call this in the order they reserved space, so the entries walked
+ * here are still intact. 'flushed' is pulled along, so that it never falls
+ * far enough behind to look ahead of head once the positions wrap.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void fix_up_head(struct logger_log *log, unsigned long end)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	unsigned long limit = end - log->size;
+	unsigned long head = log->head;
+	unsigned long flushed, old;
+
+	while ((long)(head - limit) < 0)
+		head += get_entry_len(log, logger_offset(head));
+
+	if ((head ^ log->head) >> LOGGER_LAP_SHIFT)
+		ACCESS_ONCE(log->laps) = log->laps + 1;
+	ACCESS_ONCE(log->head) = head;
+	if (log->info)
+		ACCESS_ONCE(log->info->head) = head;
+
+	/* LOGGER_FLUSH_LOG may move flushed forward at the same time */
+	flushed = ACCESS_ONCE(log->flushed);
+	while ((long)(head - flushed) > 0) {
+		old = cmpxchg(&log->flushed, flushed, head);
+		if (old == flushed) {
+			if (log->info)
+				ACCESS_ONCE(log->info->flushed) = head;
+			break;
+		}
+		flushed = old;
 	}
-
-	return 0;
-}
-
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
- */
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must have reserved the space.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, unsigned long pos,
+			 const void *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * logger_write_entry - appends the entry 'header' with payload 'msg' to 'log'
  *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * Neither the reservation nor the copy takes a lock. Preemption is disabled
+ * from reserving space to committing it, so writers that reserved before us
+ * are running and the waits for them below are short.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void logger_write_entry(struct logger_log *log,
+			       const struct logger_entry *header,
+			       const void *msg)
 {
-	size_t len;
+	size_t len = sizeof(struct logger_entry) + header->len;
+	unsigned long pos, old;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	preempt_disable();
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	pos = ACCESS_ONCE(log->reserve);
+	while ((old = cmpxchg(&log->reserve, pos, pos + len)) != pos)
+		pos = old;
 
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
+	/*
+	 * Move head past what we will overwrite before overwriting it, so
+	 * readers can tell they were lapped.
+	 */
+	while (ACCESS_ONCE(log->fixed) != pos)
+		cpu_relax();
+	smp_mb();
+	fix_up_head(log, pos + len);
+	smp_mb();
+	ACCESS_ONCE(log->fixed) = pos + len;
+
+	do_write_log(log, pos, header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), msg, header->len);
+
+	/* entries become readable in order */
+	while (ACCESS_ONCE(log->commit) != pos)
+		cpu_relax();
+	smp_wmb();
+	ACCESS_ONCE(log->commit) = pos + len;
+	if (log->info)
+		ACCESS_ONCE(log->info->commit) = pos + len;
+
+	preempt_enable();
+
+	/* wake up any blocked readers, pairs with prepare_to_wait() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is copied from user space before any space in the log is
+ * reserved, so a page fault only stalls the writer that takes it.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	char stage[LOGGER_STAGE_LEN];
 	struct logger_entry header;
 	struct timespec now;
+	char *msg = stage;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -337,46 +456,39 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len > sizeof(stage)) {
+		msg = kmalloc(header.len, GFP_KERNEL);
+		if (!msg)
+			return -ENOMEM;
+	}
 
 	while (nr_segs-- > 0) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		/* stage this segment's payload */
+		if (len && copy_from_user(msg + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
-	mutex_unlock(&log->mutex);
+	logger_write_entry(log, &header, msg);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	if (msg != stage)
+		kfree(msg);
 
 	return ret;
 }
@@ -409,12 +521,11 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_laps = ACCESS_ONCE(log->laps);
+		smp_rmb();
+		reader->r_pos = ACCESS_ONCE(log->head);
+		reader->mode = LOGGER_READ_ENTRY;
 
 		file->private_data = reader;
 	} else
@@ -432,7 +543,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -452,6 +562,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 {
 	struct logger_reader *reader;
 	struct logger_log *log;
+	unsigned long commit;
 	unsigned int ret = POLLOUT | POLLWRNORM;
 
 	if (!(file->f_mode & FMODE_READ))
@@ -462,10 +573,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (reader_pos(log, reader, &commit) != commit)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
@@ -474,10 +583,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	unsigned long pos, commit;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -488,10 +596,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		pos = reader_pos(log, reader, &commit);
+		ret = commit - pos;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,28 +605,79 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		do {
+			pos = reader_pos(log, reader, &commit);
+			if (pos == commit) {
+				ret = 0;
+				break;
+			}
+			ret = get_entry_len(log, logger_offset(pos));
+		} while (reader_lapped(log, pos));
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers catch up with this in reader_pos() */
+		ACCESS_ONCE(log->flushed) = ACCESS_ONCE(log->commit);
+		if (log->info)
+			ACCESS_ONCE(log->info->flushed) = log->flushed;
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_MODE:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != LOGGER_READ_ENTRY && arg != LOGGER_READ_BATCH) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		reader->mode = arg;
+		mutex_unlock(&reader->mutex);
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the log's struct logger_mmap_info page, followed by the ring, read
+ * only. Only readers may map the log.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long len = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ) || !log->info)
+		return -EACCES;
+	if (vma->vm_pgoff || len > PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(log->info) >> PAGE_SHIFT,
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret || len == PAGE_SIZE)
+		return ret;
+
+	return remap_pfn_range(vma, vma->vm_start + PAGE_SIZE,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       len - PAGE_SIZE, vma->vm_page_prot);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
@@ -528,6 +685,7 @@ static const struct file_operations logger_fops = {
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
+	.mmap = logger_mmap,
 	.open = logger_open,
 	.release = logger_release,
 };
@@ -535,10 +693,11 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so that
+ * readers can map it.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -548,10 +707,12 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.reserve = 0, \
+	.fixed = 0, \
+	.commit = 0, \
 	.head = 0, \
+	.flushed = 0, \
+	.laps = 0, \
 	.size = SIZE, \
 };
 
@@ -573,14 +734,186 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * Writer benchmark, run through the logger_bench debugfs file. For 1 to
+ * max_writers concurrent writers, each writer appends LOGGER_BENCH_LINES
+ * lines to a scratch log, and the aggregate rate in lines per second is
+ * stored in logger_bench_lps.
+ */
+#define LOGGER_BENCH_MAX_WRITERS	8
+#define LOGGER_BENCH_LINES		100000
+#define LOGGER_BENCH_LINE_LEN		80
+#define LOGGER_BENCH_LOG_SIZE		(256*1024)
+
+struct logger_bench {
+	struct logger_log *log;
+	struct completion done;
+};
+
+static u32 logger_bench_lps[LOGGER_BENCH_MAX_WRITERS];
+static DEFINE_MUTEX(logger_bench_mutex);
+
+static int logger_bench_thread(void *data)
+{
+	struct logger_bench *bench = data;
+	char msg[LOGGER_BENCH_LINE_LEN];
+	struct logger_entry header;
+	struct timespec now;
+	int i;
+
+	/* priority, tag and message, like a typical logcat line */
+	memset(msg, 'x', sizeof(msg));
+	msg[0] = 4;
+	memcpy(msg + 1, "logger_bench", 13);
+	msg[sizeof(msg) - 1] = '\0';
+
+	header.pid = current->tgid;
+	header.tid = current->pid;
+	header.len = sizeof(msg);
+	header.__pad = 0;
+
+	for (i = 0; i < LOGGER_BENCH_LINES; i++) {
+		now = current_kernel_time();
+		header.sec = now.tv_sec;
+		header.nsec = now.tv_nsec;
+		logger_write_entry(bench->log, &header, msg);
+		if (!(i & 255))
+			cond_resched();
+	}
+
+	complete_and_exit(&bench->done, 0);
+}
+
+static int logger_bench_run(int max_writers)
+{
+	struct logger_bench *bench;
+	struct task_struct *task;
+	struct logger_log *log;
+	ktime_t start;
+	s64 us;
+	int ret = 0;
+	int n, i;
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	bench = kcalloc(max_writers, sizeof(*bench), GFP_KERNEL);
+	if (!log || !bench) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	log->buffer = vmalloc(LOGGER_BENCH_LOG_SIZE);
+	if (!log->buffer) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(log->buffer, 0, LOGGER_BENCH_LOG_SIZE);
+	log->size = LOGGER_BENCH_LOG_SIZE;
+	init_waitqueue_head(&log->wq);
+
+	mutex_lock(&logger_bench_mutex);
+	memset(logger_bench_lps, 0, sizeof(logger_bench_lps));
+	for (n = 1; n <= max_writers; n++) {
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			bench[i].log = log;
+			init_completion(&bench[i].done);
+			task = kthread_run(logger_bench_thread, &bench[i],
+					   "logger_bench/%d", i);
+			if (IS_ERR(task)) {
+				ret = PTR_ERR(task);
+				break;
+			}
+		}
+		while (i--)
+			wait_for_completion(&bench[i].done);
+		if (ret)
+			break;
+
+		us = ktime_us_delta(ktime_get(), start);
+		logger_bench_lps[n - 1] = div64_u64((u64)n * LOGGER_BENCH_LINES *
+						    USEC_PER_SEC,
+						    max_t(s64, us, 1));
+	}
+	mutex_unlock(&logger_bench_mutex);
+
+out:
+	if (log)
+		vfree(log->buffer);
+	kfree(log);
+	kfree(bench);
+	return ret;
+}
+
+static int logger_bench_show(struct seq_file *m, void *unused)
+{
+	int i;
+
+	mutex_lock(&logger_bench_mutex);
+	for (i = 0; i < LOGGER_BENCH_MAX_WRITERS; i++) {
+		if (!logger_bench_lps[i])
+			break;
+		seq_printf(m, "%d %u\n", i + 1, logger_bench_lps[i]);
+	}
+	mutex_unlock(&logger_bench_mutex);
+
+	return 0;
+}
+
+static int logger_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, logger_bench_show, inode->i_private);
+}
+
+static ssize_t logger_bench_write(struct file *file, const char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	unsigned long writers;
+	char buf[8];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	ret = strict_strtoul(buf, 10, &writers);
+	if (ret)
+		return ret;
+
+	if (writers < 1 || writers > LOGGER_BENCH_MAX_WRITERS)
+		return -EINVAL;
+
+	ret = logger_bench_run(writers);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+static const struct file_operations logger_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = logger_bench_open,
+	.read = seq_read,
+	.write = logger_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->info = (struct logger_mmap_info *)get_zeroed_page(GFP_KERNEL);
+	if (unlikely(!log->info))
+		return -ENOMEM;
+	log->info->size = log->size;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		free_page((unsigned long)log->info);
+		log->info = NULL;
 		return ret;
 	}
 
@@ -610,6 +943,9 @@ static int __init logger_init(void)
 	if (unlikely(ret))
 		goto out;
 
+	debugfs_create_file("logger_bench", S_IRUGO | S_IWUSR, NULL, NULL,
+			    &logger_bench_fops);
+
 out:
 	return ret;
 }
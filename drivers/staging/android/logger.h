@@ -45,5 +45,30 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* read() mode */
+
+/* Modes for LOGGER_SET_READ_MODE */
+#define LOGGER_READ_ENTRY	0	/* one entry per read(), the default */
+#define LOGGER_READ_BATCH	1	/* as many whole entries as fit */
+
+/*
+ * A log opened for reading can be mapped read-only: this structure on the
+ * first page, followed by the ring itself.
+ *
+ * Positions are free-running byte counts; an entry at position 'pos' starts
+ * at offset (pos & (size - 1)) into the ring, and may wrap around its end.
+ * Entries between head and commit are readable. Writers move head past an
+ * entry before they overwrite it, so a consumer that copied out an entry
+ * must check that head has not passed its position, and restart from head
+ * if it has. flushed always lies between head and commit. Positions wrap
+ * at 4 GB, so a consumer that fell more than that behind cannot tell from
+ * its position alone; one that was idle for long should restart from head.
+ */
+struct logger_mmap_info {
+	__u32		size;	/* size of the ring */
+	__u32		head;	/* position of the oldest intact entry */
+	__u32		commit;	/* entries before this position are complete */
+	__u32		flushed; /* entries before this position were flushed */
+};
 
 #endif /* _LINUX_LOGGER_H */
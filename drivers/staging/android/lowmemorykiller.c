@@ -35,6 +35,15 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/vmpressure.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,15 +61,91 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+/*
+ * Reclaim pressure (0-100) at which the minfree levels are checked without
+ * waiting for the next shrinker call.  Values above 100 disable it.
+ */
+static int lowmem_vmpressure_level = 90;
+
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/* serializes victim selection between the shrinker and vmpressure */
+static DEFINE_MUTEX(lowmem_kill_lock);
+
+/*
+ * Thread groups are kept in buckets by oom_adj, updated on fork, exec,
+ * exit and oom_adj changes, so that finding victims does not walk the
+ * task list.  Kernel threads are added when they exec a user program.
+ * Buckets are LRU ordered: a group moves to the tail when its oom_adj is
+ * written.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct list_head lowmem_buckets[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
+/*
+ * References to every live group of the highest non-empty bucket, taken
+ * for each kill.  Grown as needed, protected by lowmem_kill_lock.
+ */
+#define LOWMEM_CANDIDATES_INIT	64
+static struct task_struct **lowmem_cand;
+static int lowmem_cand_size;
+
+/*
+ * The last LOWMEM_KILL_LOG kills, with what triggered them and how long
+ * the victim took to go away, for tuning minfree and adj.  A kill is
+ * pending until the task_free notifier sees the victim, so several
+ * deaths can be outstanding at once.
+ */
+#define LOWMEM_KILL_LOG		32
+
+struct lowmem_kill_entry {
+	struct task_struct *task;	/* victim, NULL once it is gone */
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int oom_adj;
+	int min_adj;
+	int rss;			/* pages */
+	int other_free;			/* pages */
+	int other_file;			/* pages */
+	int minfree;			/* pages, level that was crossed */
+	ktime_t selected;
+	s64 latency_us;			/* -1 while pending */
+};
+
+static struct lowmem_kill_entry lowmem_kill_log[LOWMEM_KILL_LOG];
+static unsigned int lowmem_kill_count;
+static int lowmem_kill_pending;
+static u64 lowmem_kill_latency_total_us;
+static s64 lowmem_kill_latency_max_us;
+/* taken from the task_free notifier, which can run from softirq */
+static DEFINE_SPINLOCK(lowmem_kill_log_lock);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+/*
+ * test_set_oom_score_adj() (swapoff, ksm) raises oom_score_adj alone, so
+ * go by whichever of the two asks for the earlier kill.
+ */
+static int lowmem_oom_adj(struct signal_struct *sig)
+{
+	int score_adj = sig->oom_score_adj * OOM_ADJUST_MAX / OOM_SCORE_ADJ_MAX;
+
+	return max_t(int, sig->oom_adj, score_adj);
+}
+
+static inline struct list_head *lowmem_bucket(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -72,24 +157,295 @@ static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	unsigned long flags;
+	int i;
 
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	if (!lowmem_kill_pending)
+		return NOTIFY_OK;
+
+	spin_lock_irqsave(&lowmem_kill_log_lock, flags);
+	for (i = 0; i < LOWMEM_KILL_LOG; i++) {
+		struct lowmem_kill_entry *e = &lowmem_kill_log[i];
+
+		if (e->task != task)
+			continue;
+		e->task = NULL;
+		e->latency_us = ktime_us_delta(ktime_get(), e->selected);
+		lowmem_kill_pending--;
+		lowmem_kill_latency_total_us += e->latency_us;
+		if (e->latency_us > lowmem_kill_latency_max_us)
+			lowmem_kill_latency_max_us = e->latency_us;
+		trace_lowmemory_kill_done(e->pid, e->latency_us);
+		break;
+	}
+	spin_unlock_irqrestore(&lowmem_kill_log_lock, flags);
+
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	struct signal_struct *sig = task->signal;
+
+	spin_lock(&lowmem_bucket_lock);
+	switch (val) {
+	case OOM_ADJ_FORK:
+		if (!(task->flags & PF_KTHREAD))
+			list_add_tail(&sig->lowmem_node,
+				      lowmem_bucket(lowmem_oom_adj(sig)));
+		break;
+	case OOM_ADJ_EXEC:
+		if (list_empty(&sig->lowmem_node))
+			list_add_tail(&sig->lowmem_node,
+				      lowmem_bucket(lowmem_oom_adj(sig)));
+		break;
+	case OOM_ADJ_EXIT:
+		list_del_init(&sig->lowmem_node);
+		break;
+	case OOM_ADJ_CHANGED:
+		if (!list_empty(&sig->lowmem_node))
+			list_move_tail(&sig->lowmem_node,
+				       lowmem_bucket(lowmem_oom_adj(sig)));
+		break;
+	}
+	spin_unlock(&lowmem_bucket_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+/*
+ * Returns the lowest oom_adj that may be killed at the current free and
+ * file page counts, or OOM_ADJUST_MAX + 1 if memory is not low.  The
+ * minfree level that was crossed is stored in *minfree.
+ */
+static int lowmem_min_adj(int other_free, int other_file, int *minfree)
+{
+	int i;
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i]) {
+			*minfree = lowmem_minfree[i];
+			return lowmem_adj[i];
+		}
+	}
+	*minfree = 0;
+	return OOM_ADJUST_MAX + 1;
+}
+
+/*
+ * Exiting and zombie groups stay bucketed until they are reaped, but
+ * have nothing left to free.  Only a hint, lowmem_kill checks again.
+ */
+static bool lowmem_group_has_mm(struct signal_struct *sig)
+{
+	struct task_struct *p = sig->curr_target;
+	struct task_struct *t = p;
+
+	do {
+		if (ACCESS_ONCE(t->mm))
+			return true;
+	} while_each_thread(p, t);
+
+	return false;
+}
+
+/*
+ * Counts the groups with memory in the highest bucket from *adj down to
+ * min_adj that has any, taking a reference on one task of each of the
+ * first lowmem_cand_size of them.  *adj is left at that bucket.
+ */
+static int lowmem_scan(int *adj, int min_adj)
+{
+	struct signal_struct *sig;
+	int n = 0;
+
+	rcu_read_lock();
+	spin_lock(&lowmem_bucket_lock);
+	for (; *adj >= min_adj; (*adj)--) {
+		list_for_each_entry(sig, lowmem_bucket(*adj), lowmem_node) {
+			if (!lowmem_group_has_mm(sig))
+				continue;
+			if (n < lowmem_cand_size) {
+				lowmem_cand[n] = sig->curr_target;
+				get_task_struct(lowmem_cand[n]);
+			}
+			n++;
+		}
+		if (n)
+			break;
+	}
+	spin_unlock(&lowmem_bucket_lock);
+	rcu_read_unlock();
+	return n;
+}
+
+static void lowmem_put_candidates(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		put_task_struct(lowmem_cand[i]);
+}
+
+/*
+ * Fills lowmem_cand with the whole highest non-empty bucket from *adj
+ * down and returns the number of entries.  If the buffer cannot grow to
+ * fit the bucket, only its first lowmem_cand_size groups are returned.
+ */
+static int lowmem_candidates(int *adj, int min_adj)
+{
+	struct task_struct **cand;
+	int n, size;
+
+	n = lowmem_scan(adj, min_adj);
+	if (n <= lowmem_cand_size)
+		return n;
+
+	/* no sleeping allocation, we may be called from reclaim */
+	size = n + n / 2;
+	cand = krealloc(lowmem_cand, size * sizeof(*cand),
+			GFP_NOWAIT | __GFP_NOWARN);
+	if (!cand)
+		return lowmem_cand_size;
+
+	/* krealloc copied the references over and freed the old buffer */
+	lowmem_cand = cand;
+	lowmem_put_candidates(lowmem_cand_size);
+	lowmem_cand_size = size;
+	return min(lowmem_scan(adj, min_adj), lowmem_cand_size);
+}
+
+static void lowmem_log_kill(struct task_struct *selected, int oom_adj,
+			    int min_adj, int rss, int other_free,
+			    int other_file, int minfree)
+{
+	struct lowmem_kill_entry *e;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_kill_log_lock, flags);
+	e = &lowmem_kill_log[lowmem_kill_count++ % LOWMEM_KILL_LOG];
+	/* an entry still pending after LOWMEM_KILL_LOG kills is dropped */
+	if (e->task)
+		lowmem_kill_pending--;
+	e->task = selected;
+	e->pid = selected->pid;
+	memcpy(e->comm, selected->comm, TASK_COMM_LEN);
+	e->oom_adj = oom_adj;
+	e->min_adj = min_adj;
+	e->rss = rss;
+	e->other_free = other_free;
+	e->other_file = other_file;
+	e->minfree = minfree;
+	e->selected = ktime_get();
+	e->latency_us = -1;
+	lowmem_kill_pending++;
+	spin_unlock_irqrestore(&lowmem_kill_log_lock, flags);
+}
+
+/*
+ * Picks the candidate with the highest oom_adj, and the largest RSS among
+ * those, if its oom_adj is at least min_adj.  Returns NULL if none of
+ * them has anything to free.
+ */
+static struct task_struct *lowmem_select(int n, int min_adj,
+					 int *selected_tasksize,
+					 int *selected_oom_adj)
 {
-	struct task_struct *p;
 	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
 	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
+
+	rcu_read_lock();
+	for (i = 0; i < n; i++) {
+		struct task_struct *p;
+		int oom_adj, tasksize;
+
+		p = find_lock_task_mm(lowmem_cand[i]);
+		if (!p)
+			continue;
+		oom_adj = lowmem_oom_adj(p->signal);
+		tasksize = get_mm_rss(p->mm);
+		task_unlock(p);
+		if (oom_adj < min_adj || tasksize <= 0)
+			continue;
+		if (selected) {
+			if (oom_adj < *selected_oom_adj)
+				continue;
+			if (oom_adj == *selected_oom_adj &&
+			    tasksize <= *selected_tasksize)
+				continue;
+		}
+		selected = lowmem_cand[i];
+		*selected_tasksize = tasksize;
+		*selected_oom_adj = oom_adj;
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     p->pid, p->comm, oom_adj, tasksize);
+	}
+	rcu_read_unlock();
+
+	return selected;
+}
+
+/*
+ * Kills the best candidate of the highest bucket at or above min_adj
+ * that has one.  Returns the RSS of the victim, or 0 if nothing was
+ * killed.  Caller holds lowmem_kill_lock.
+ */
+static int lowmem_kill(int min_adj, int other_free, int other_file,
+		       int minfree)
+{
+	struct task_struct *selected = NULL;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int selected_oom_adj = min_adj;
+	int adj, n;
+
+	/* skip a bucket whose groups all have nothing left to free */
+	for (adj = OOM_ADJUST_MAX; !selected && adj >= min_adj; adj--) {
+		n = lowmem_candidates(&adj, min_adj);
+		selected = lowmem_select(n, min_adj, &selected_tasksize,
+					 &selected_oom_adj);
+		if (selected)
+			get_task_struct(selected);
+		lowmem_put_candidates(n);
+	}
+	if (!selected)
+		return 0;
+
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+		     selected->pid, selected->comm,
+		     selected_oom_adj, selected_tasksize);
+	trace_lowmemory_kill(selected, selected_oom_adj,
+			     selected_tasksize, other_free,
+			     other_file, minfree);
+	lowmem_log_kill(selected, selected_oom_adj, min_adj,
+			selected_tasksize, other_free, other_file,
+			minfree);
+	lowmem_deathpending = selected;
+	lowmem_deathpending_timeout = jiffies + HZ;
+	send_sig(SIGKILL, selected, 0);
+	put_task_struct(selected);
+
+	return selected_tasksize;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int rem = 0;
+	int min_adj, minfree;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -105,17 +461,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	min_adj = lowmem_min_adj(other_free, other_file, &minfree);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -129,55 +475,15 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
-	}
+	/* the other path is already killing, let it finish */
+	if (!mutex_trylock(&lowmem_kill_lock))
+		return 0;
+	rem -= lowmem_kill(min_adj, other_free, other_file, minfree);
+	mutex_unlock(&lowmem_kill_lock);
+
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -186,17 +492,137 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int
+vmpressure_notify_func(struct notifier_block *self, unsigned long pressure,
+		       void *data)
+{
+	int min_adj, minfree;
+	int other_free, other_file;
+
+	if (pressure < lowmem_vmpressure_level)
+		return NOTIFY_OK;
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return NOTIFY_OK;
+
+	other_free = global_page_state(NR_FREE_PAGES);
+	other_file = global_page_state(NR_FILE_PAGES) -
+					global_page_state(NR_SHMEM);
+	min_adj = lowmem_min_adj(other_free, other_file, &minfree);
+	lowmem_print(3, "lowmem vmpressure %lu, ofree %d %d, ma %d\n",
+		     pressure, other_free, other_file, min_adj);
+	if (min_adj == OOM_ADJUST_MAX + 1)
+		return NOTIFY_OK;
+
+	if (mutex_trylock(&lowmem_kill_lock)) {
+		lowmem_kill(min_adj, other_free, other_file, minfree);
+		mutex_unlock(&lowmem_kill_lock);
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block vmpressure_nb = {
+	.notifier_call	= vmpressure_notify_func,
+};
+
+static int lowmem_kills_show(struct seq_file *m, void *unused)
+{
+	unsigned int i, count;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_kill_log_lock, flags);
+	count = lowmem_kill_count;
+	seq_printf(m, "kills: %u pending: %d latency_us total %llu max %lld\n",
+		   count, lowmem_kill_pending,
+		   (unsigned long long)lowmem_kill_latency_total_us,
+		   (long long)lowmem_kill_latency_max_us);
+	seq_puts(m, "pid comm adj min_adj rss free file minfree latency_us\n");
+	i = count > LOWMEM_KILL_LOG ? count - LOWMEM_KILL_LOG : 0;
+	for (; i < count; i++) {
+		struct lowmem_kill_entry *e = &lowmem_kill_log[i % LOWMEM_KILL_LOG];
+
+		seq_printf(m, "%d %s %d %d %d %d %d %d %lld\n",
+			   e->pid, e->comm, e->oom_adj, e->min_adj, e->rss,
+			   e->other_free, e->other_file, e->minfree,
+			   (long long)e->latency_us);
+	}
+	spin_unlock_irqrestore(&lowmem_kill_log_lock, flags);
+	return 0;
+}
+
+static int lowmem_kills_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_kills_show, inode->i_private);
+}
+
+static const struct file_operations lowmem_kills_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_kills_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs_kills;
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	lowmem_cand = kmalloc(LOWMEM_CANDIDATES_INIT * sizeof(*lowmem_cand),
+			      GFP_KERNEL);
+	if (!lowmem_cand)
+		return -ENOMEM;
+	lowmem_cand_size = LOWMEM_CANDIDATES_INIT;
+
+	/*
+	 * Forks and exits are notified with tasklist_lock held for
+	 * writing, so none is missed between registering and the walk.
+	 */
+	register_oom_adj_notifier(&oom_adj_nb);
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_bucket_lock);
+	for_each_process(p) {
+		if (p->flags & PF_KTHREAD)
+			continue;
+		if (list_empty(&p->signal->lowmem_node))
+			list_add_tail(&p->signal->lowmem_node,
+				      lowmem_bucket(lowmem_oom_adj(p->signal)));
+	}
+	spin_unlock(&lowmem_bucket_lock);
+	read_unlock(&tasklist_lock);
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	vmpressure_notifier_register(&vmpressure_nb);
+	lowmem_debugfs_kills = debugfs_create_file("lowmemorykiller", S_IRUGO,
+						   NULL, NULL,
+						   &lowmem_kills_fops);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct signal_struct *sig, *next;
+	int i;
+
+	debugfs_remove(lowmem_debugfs_kills);
+	vmpressure_notifier_unregister(&vmpressure_nb);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
+	unregister_oom_adj_notifier(&oom_adj_nb);
+
+	spin_lock(&lowmem_bucket_lock);
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		list_for_each_entry_safe(sig, next, &lowmem_buckets[i],
+					 lowmem_node)
+			list_del_init(&sig->lowmem_node);
+	spin_unlock(&lowmem_bucket_lock);
+	kfree(lowmem_cand);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,9 +631,10 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(vmpressure_level, lowmem_vmpressure_level, int,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
 
 MODULE_LICENSE("GPL");
-
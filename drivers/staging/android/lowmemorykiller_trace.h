@@ -0,0 +1,72 @@
+/* drivers/staging/android/lowmemorykiller_trace.h
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmemory_kill,
+	TP_PROTO(struct task_struct *killed_task, int oom_adj, int rss,
+		 int other_free, int other_file, int minfree),
+	TP_ARGS(killed_task, oom_adj, rss, other_free, other_file, minfree),
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_adj)
+		__field(int, rss)
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(int, minfree)
+	),
+	TP_fast_assign(
+		memcpy(__entry->comm, killed_task->comm, TASK_COMM_LEN);
+		__entry->pid = killed_task->pid;
+		__entry->oom_adj = oom_adj;
+		__entry->rss = rss;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->minfree = minfree;
+	),
+	TP_printk("%s pid=%d adj=%d rss=%d free=%d file=%d minfree=%d",
+		  __entry->comm, __entry->pid, __entry->oom_adj, __entry->rss,
+		  __entry->other_free, __entry->other_file, __entry->minfree)
+);
+
+TRACE_EVENT(lowmemory_kill_done,
+	TP_PROTO(pid_t pid, s64 latency_us),
+	TP_ARGS(pid, latency_us),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(s64, latency_us)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("pid=%d latency=%lldus", __entry->pid,
+		  (long long)__entry->latency_us)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH ../../drivers/staging/android
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
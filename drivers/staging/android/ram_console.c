@@ -26,6 +26,9 @@
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 #include <linux/rslib.h>
 #endif
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+#include <linux/lzo.h>
+#endif
 
 struct ram_console_buffer {
 	uint32_t    sig;
@@ -35,6 +38,7 @@ struct ram_console_buffer {
 };
 
 #define RAM_CONSOLE_SIG (0x43474244) /* DBGC */
+#define RAM_CONSOLE_ZSIG (0x5a474244) /* DBGZ */
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_EARLY_INIT
 static char __initdata
@@ -56,6 +60,31 @@ static int ram_console_bad_blocks;
 #define ECC_POLY CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_POLYNOMIAL
 #endif
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+/*
+ * In compressed mode the data area holds the length of the block being
+ * filled, the block itself, and a ring of LZO compressed blocks. The
+ * header's start and size describe the ring, not the text.
+ */
+#define ZBLOCK_SIZE CONFIG_ANDROID_RAM_CONSOLE_COMPRESS_BLOCK_SIZE
+#define ZRAW_LEN_OFF 0
+#define ZRAW_OFF sizeof(uint32_t)
+#define ZRING_OFF (ZRAW_OFF + ZBLOCK_SIZE)
+
+/* A block in the ring, stored uncompressed if clen == len */
+struct ram_console_zrecord {
+	uint16_t    len;
+	uint16_t    clen;
+};
+
+static int ram_console_compress;
+static size_t ram_console_ring_size;
+static uint32_t ram_console_raw_len;
+static uint8_t ram_console_zraw[ZBLOCK_SIZE];
+static uint8_t ram_console_zout[lzo1x_worst_compress(ZBLOCK_SIZE)];
+static uint8_t ram_console_zwrk[LZO1X_1_MEM_COMPRESS];
+#endif
+
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 static void ram_console_encode_rs8(uint8_t *data, size_t len, uint8_t *ecc)
 {
@@ -79,7 +108,7 @@ static int ram_console_decode_rs8(void *data, size_t len, uint8_t *ecc)
 }
 #endif
 
-static void ram_console_update(const char *s, unsigned int count)
+static void ram_console_update_at(size_t start, const void *s, size_t count)
 {
 	struct ram_console_buffer *buffer = ram_console_buffer;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
@@ -88,21 +117,26 @@ static void ram_console_update(const char *s, unsigned int count)
 	uint8_t *par;
 	int size = ECC_BLOCK_SIZE;
 #endif
-	memcpy(buffer->data + buffer->start, s, count);
+	memcpy(buffer->data + start, s, count);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	block = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
+	block = buffer->data + (start & ~(ECC_BLOCK_SIZE - 1));
 	par = ram_console_par_buffer +
-	      (buffer->start / ECC_BLOCK_SIZE) * ECC_SIZE;
+	      (start / ECC_BLOCK_SIZE) * ECC_SIZE;
 	do {
 		if (block + ECC_BLOCK_SIZE > buffer_end)
 			size = buffer_end - block;
 		ram_console_encode_rs8(block, size, par);
 		block += ECC_BLOCK_SIZE;
 		par += ECC_SIZE;
-	} while (block < buffer->data + buffer->start + count);
+	} while (block < buffer->data + start + count);
 #endif
 }
 
+static void ram_console_update(const char *s, unsigned int count)
+{
+	ram_console_update_at(ram_console_buffer->start, s, count);
+}
+
 static void ram_console_update_header(void)
 {
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
@@ -114,12 +148,116 @@ static void ram_console_update_header(void)
 #endif
 }
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+static void ram_console_set_raw_len(uint32_t len)
+{
+	ram_console_raw_len = len;
+	ram_console_update_at(ZRAW_LEN_OFF, &len, sizeof(len));
+}
+
+static void ram_console_ring_write(size_t off, const void *s, size_t count)
+{
+	size_t len = min(count, ram_console_ring_size - off);
+
+	ram_console_update_at(ZRING_OFF + off, s, len);
+	if (count != len)
+		ram_console_update_at(ZRING_OFF, s + len, count - len);
+}
+
+static void ram_console_ring_read(struct ram_console_buffer *buffer,
+				  size_t off, void *dest, size_t count)
+{
+	size_t len = min(count, ram_console_ring_size - off);
+
+	memcpy(dest, buffer->data + ZRING_OFF + off, len);
+	if (count != len)
+		memcpy(dest + len, buffer->data + ZRING_OFF, count - len);
+}
+
+static inline size_t ram_console_ring_off(size_t off)
+{
+	return off >= ram_console_ring_size ? off - ram_console_ring_size : off;
+}
+
+/*
+ * Compress the full block into the ring, dropping the oldest blocks to
+ * make room. The ring header is updated before the block is emptied, so a
+ * crash in between repeats the block rather than losing it.
+ */
+static void ram_console_zflush(void)
+{
+	struct ram_console_buffer *buffer = ram_console_buffer;
+	struct ram_console_zrecord rec;
+	const void *src = ram_console_zout;
+	size_t clen = sizeof(ram_console_zout);
+	size_t need, off;
+
+	if (lzo1x_1_compress(ram_console_zraw, ram_console_raw_len,
+			     ram_console_zout, &clen,
+			     ram_console_zwrk) != LZO_E_OK ||
+	    clen >= ram_console_raw_len) {
+		src = ram_console_zraw;
+		clen = ram_console_raw_len;
+	}
+	rec.len = ram_console_raw_len;
+	rec.clen = clen;
+	need = sizeof(rec) + clen;
+
+	while (ram_console_ring_size - buffer->size < need) {
+		struct ram_console_zrecord old;
+		size_t old_size;
+
+		ram_console_ring_read(buffer, buffer->start, &old, sizeof(old));
+		old_size = sizeof(old) + old.clen;
+		if (old_size > buffer->size) {
+			buffer->start = 0;
+			buffer->size = 0;
+			break;
+		}
+		buffer->start = ram_console_ring_off(buffer->start + old_size);
+		buffer->size -= old_size;
+	}
+
+	off = ram_console_ring_off(buffer->start + buffer->size);
+	ram_console_ring_write(off, &rec, sizeof(rec));
+	ram_console_ring_write(ram_console_ring_off(off + sizeof(rec)),
+			       src, clen);
+	buffer->size += need;
+	ram_console_update_header();
+	ram_console_set_raw_len(0);
+}
+
+static void ram_console_zwrite(const char *s, unsigned int count)
+{
+	while (count) {
+		size_t len = min_t(size_t, count,
+				   ZBLOCK_SIZE - ram_console_raw_len);
+
+		memcpy(ram_console_zraw + ram_console_raw_len, s, len);
+		ram_console_update_at(ZRAW_OFF + ram_console_raw_len, s, len);
+		ram_console_set_raw_len(ram_console_raw_len + len);
+		s += len;
+		count -= len;
+
+		if (ram_console_raw_len == ZBLOCK_SIZE)
+			ram_console_zflush();
+	}
+}
+#endif
+
 static void
 ram_console_write(struct console *console, const char *s, unsigned int count)
 {
 	int rem;
 	struct ram_console_buffer *buffer = ram_console_buffer;
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (ram_console_compress) {
+		ram_console_zwrite(s, count);
+		return;
+	}
+#endif
+
 	if (count > ram_console_buffer_size) {
 		s += count - ram_console_buffer_size;
 		count = ram_console_buffer_size;
@@ -155,25 +293,83 @@ void ram_console_enable_console(int enabled)
 		ram_console.flags &= ~CON_ENABLED;
 }
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+/*
+ * Walk the ring of a compressed buffer left by the previous boot, and
+ * return the size of its text, or decompress the text into 'dest' if it is
+ * not NULL. Stops at the first damaged block.
+ */
+static size_t __init
+ram_console_zsave_old(struct ram_console_buffer *buffer, char *dest)
+{
+	struct ram_console_zrecord rec;
+	size_t off = buffer->start;
+	size_t left = buffer->size;
+	size_t total = 0;
+	uint32_t raw_len;
+	size_t len;
+
+	while (left >= sizeof(rec)) {
+		ram_console_ring_read(buffer, off, &rec, sizeof(rec));
+		if (rec.len > ZBLOCK_SIZE || rec.clen > rec.len ||
+		    sizeof(rec) + rec.clen > left)
+			break;
+		off = ram_console_ring_off(off + sizeof(rec));
+
+		if (dest) {
+			ram_console_ring_read(buffer, off, ram_console_zout,
+					      rec.clen);
+			len = rec.len;
+			if (rec.clen == rec.len)
+				memcpy(dest + total, ram_console_zout, len);
+			else if (lzo1x_decompress_safe(ram_console_zout,
+					rec.clen, (uint8_t *)dest + total,
+					&len) != LZO_E_OK || len != rec.len)
+				break;
+		}
+		total += rec.len;
+		off = ram_console_ring_off(off + rec.clen);
+		left -= sizeof(rec) + rec.clen;
+	}
+
+	memcpy(&raw_len, buffer->data + ZRAW_LEN_OFF, sizeof(raw_len));
+	if (raw_len <= ZBLOCK_SIZE) {
+		if (dest)
+			memcpy(dest + total, buffer->data + ZRAW_OFF, raw_len);
+		total += raw_len;
+	}
+
+	return total;
+}
+#endif
+
 static void __init
 ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 	char *dest)
 {
 	size_t old_log_size = buffer->size;
 	size_t bootinfo_size = 0;
-	size_t total_size = old_log_size;
+	size_t total_size;
 	char *ptr;
 	const char *bootinfo_label = "Boot info:\n";
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	uint8_t *block;
 	uint8_t *par;
+	uint8_t *data_end = buffer->data + buffer->size;
 	char strbuf[80];
 	int strbuf_len = 0;
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	/* the ring only covers the whole data area once it wrapped */
+	if (buffer->sig == RAM_CONSOLE_ZSIG)
+		data_end = buffer->data + ZRING_OFF +
+			   (buffer->start ? ram_console_ring_size : buffer->size);
+#endif
+
 	block = buffer->data;
 	par = ram_console_par_buffer;
-	while (block < buffer->data + buffer->size) {
+	while (block < data_end) {
 		int numerr;
 		int size = ECC_BLOCK_SIZE;
 		if (block + size > buffer->data + ram_console_buffer_size)
@@ -204,6 +400,14 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 				      "\nNo errors detected\n");
 	if (strbuf_len >= sizeof(strbuf))
 		strbuf_len = sizeof(strbuf) - 1;
+#endif
+
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (buffer->sig == RAM_CONSOLE_ZSIG)
+		old_log_size = ram_console_zsave_old(buffer, NULL);
+#endif
+	total_size = old_log_size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	total_size += strbuf_len;
 #endif
 
@@ -222,10 +426,21 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 
 	ram_console_old_log = dest;
 	ram_console_old_log_size = total_size;
-	memcpy(ram_console_old_log,
-	       &buffer->data[buffer->start], buffer->size - buffer->start);
-	memcpy(ram_console_old_log + buffer->size - buffer->start,
-	       &buffer->data[0], buffer->start);
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (buffer->sig == RAM_CONSOLE_ZSIG) {
+		size_t len = ram_console_zsave_old(buffer, ram_console_old_log);
+
+		/* a block failed to decompress, drop the rest */
+		ram_console_old_log_size -= old_log_size - len;
+		old_log_size = len;
+	} else
+#endif
+	{
+		memcpy(ram_console_old_log, &buffer->data[buffer->start],
+		       buffer->size - buffer->start);
+		memcpy(ram_console_old_log + buffer->size - buffer->start,
+		       &buffer->data[0], buffer->start);
+	}
 	ptr = ram_console_old_log + old_log_size;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	memcpy(ptr, strbuf, strbuf_len);
@@ -298,6 +513,29 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	}
 #endif
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (ram_console_buffer_size >= ZRING_OFF + 2 * ZBLOCK_SIZE) {
+		ram_console_compress = 1;
+		ram_console_ring_size = ram_console_buffer_size - ZRING_OFF;
+	} else
+		printk(KERN_INFO "ram_console: buffer too small to "
+		       "compress, size %zu\n", ram_console_buffer_size);
+
+	if (buffer->sig == RAM_CONSOLE_ZSIG) {
+		if (!ram_console_compress ||
+		    buffer->size > ram_console_ring_size ||
+		    buffer->start >= ram_console_ring_size)
+			printk(KERN_INFO "ram_console: found existing invalid "
+			       "compressed buffer, size %d, start %d\n",
+			       buffer->size, buffer->start);
+		else {
+			printk(KERN_INFO "ram_console: found existing "
+			       "compressed buffer, size %d, start %d\n",
+			       buffer->size, buffer->start);
+			ram_console_save_old(buffer, bootinfo, old_buf);
+		}
+	} else
+#endif
 	if (buffer->sig == RAM_CONSOLE_SIG) {
 		if (buffer->size > ram_console_buffer_size
 		    || buffer->start > buffer->size)
@@ -318,6 +556,13 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	buffer->sig = RAM_CONSOLE_SIG;
 	buffer->start = 0;
 	buffer->size = 0;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (ram_console_compress) {
+		buffer->sig = RAM_CONSOLE_ZSIG;
+		ram_console_set_raw_len(0);
+		ram_console_update_header();
+	}
+#endif
 
 	register_console(&ram_console);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ENABLE_VERBOSE
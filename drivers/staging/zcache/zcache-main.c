@@ -6,7 +6,8 @@
  *
  * Zcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
- * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
+ * page-accessible memory [1] interfaces, both utilizing compression through
+ * the crypto API (lzo1x by default, selectable per pool):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * 2) xvmalloc is used for persistent pages.
  * Xvmalloc (based on the TLSF allocator) has very low fragmentation
@@ -23,7 +24,7 @@
 #include <linux/cpu.h>
 #include <linux/highmem.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -53,6 +54,40 @@
 
 #define MAX_POOLS_PER_CLIENT 16
 
+/*
+ * Compressors zcache can use. Each pool compresses with the one that
+ * was selected (through sysfs "compressor", or "zcache=<name>" at boot)
+ * when it was created.
+ */
+#define ZCACHE_MAX_BACKENDS 3
+static const char * const zcache_backends[ZCACHE_MAX_BACKENDS] = {
+	"lzo",
+	"lz4",
+	"deflate",
+};
+static unsigned int zcache_comp;	/* index into zcache_backends */
+static int zcache_enabled;
+
+struct zcache_pool {
+	struct tmem_pool tmem;
+	unsigned int comp;
+};
+
+static inline unsigned int zcache_pool_comp(struct tmem_pool *pool)
+{
+	return container_of(pool, struct zcache_pool, tmem)->comp;
+}
+
+static int zcache_comp_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ZCACHE_MAX_BACKENDS; i++)
+		if (!strcmp(name, zcache_backends[i]))
+			return crypto_has_comp(name, 0, 0) ? i : -1;
+	return -1;
+}
+
 #define MAX_CLIENTS 16
 #define LOCAL_CLIENT ((uint16_t)-1)
 
@@ -96,6 +131,13 @@ static inline bool is_local_client(struct zcache_client *cli)
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * The buddied and unbuddied lists are per-cpu, each set under a lock of
+ * its own, and a new zbud is only paired with a zbpg on the local cpu's
+ * lists, so cpus putting pages in parallel do not serialize on them.
+ * A zbpg stays on the lists of the cpu that created it ("zbpg->cpu"),
+ * which frees and eviction lock.  Each cpu also caches a few unused
+ * zbpgs, moved to and from the global unused list in batches.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -109,12 +151,14 @@ struct zbud_hdr {
 	struct tmem_oid oid;
 	uint32_t index;
 	uint16_t size; /* compressed size in bytes, zero means unused */
+	unsigned long stamp; /* jiffies at put */
 	DECL_SENTINEL
 };
 
 struct zbud_page {
 	struct list_head bud_list;
 	spinlock_t lock;
+	int cpu; /* whose lists the zbpg is on */
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
 	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
@@ -127,24 +171,37 @@ struct zbud_page {
 				CHUNK_MASK) >> CHUNK_SHIFT)
 #define MAX_CHUNK	(NCHUNKS-1)
 
-static struct {
-	struct list_head list;
-	unsigned count;
-} zbud_unbuddied[NCHUNKS];
-/* list N contains pages with N chunks USED and NCHUNKS-N unused */
-/* element 0 is never used but optimizing that isn't worth it */
-static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
+/* unused zbpgs a cpu keeps, and how many move to/from the global list */
+#define ZBUD_PCPU_BATCH 8
+#define ZBUD_PCPU_HIGH (2 * ZBUD_PCPU_BATCH)
 
-struct list_head zbud_buddied_list;
-static unsigned long zcache_zbud_buddied_count;
+struct zbud_pcpu {
+	/* protects all lists and counts below */
+	spinlock_t lock;
+	struct {
+		struct list_head list;
+		unsigned count;
+	} unbuddied[NCHUNKS];
+	/* list N contains pages with N chunks USED and NCHUNKS-N unused */
+	/* element 0 is never used but optimizing that isn't worth it */
+	struct list_head buddied;
+	unsigned long buddied_count;
+	struct list_head unused;
+	unsigned long unused_count;
+	/* contention statistics, summed over cpus in sysfs */
+	unsigned long lock_contended;
+	unsigned long remote_frees;
+	unsigned long cache_hits;
+};
+static DEFINE_PER_CPU(struct zbud_pcpu, zbud_pcpu);
 
-/* protects the buddied list and all unbuddied lists */
-static DEFINE_SPINLOCK(zbud_budlists_spinlock);
+static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 
 static LIST_HEAD(zbpg_unused_list);
 static unsigned long zcache_zbpg_unused_list_count;
+static unsigned long zcache_zbpg_unused_contended;
 
-/* protects the unused page list */
+/* protects the global unused page list, nests inside zbud_pcpu.lock */
 static DEFINE_SPINLOCK(zbpg_unused_list_spinlock);
 
 static atomic_t zcache_zbud_curr_raw_pages;
@@ -214,22 +271,72 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
  * zbud raw page management
  */
 
-static struct zbud_page *zbud_alloc_raw_page(void)
+/*
+ * Count how often a per-cpu list lock is found held, e.g. by another
+ * cpu freeing a zbud of a zbpg on this cpu's lists.
+ */
+static inline void zbud_pcpu_lock(struct zbud_pcpu *zp)
+{
+	if (unlikely(!spin_trylock(&zp->lock))) {
+		spin_lock(&zp->lock);
+		zp->lock_contended++;
+	}
+}
+
+static inline void zbpg_unused_lock(void)
+{
+	if (unlikely(!spin_trylock(&zbpg_unused_list_spinlock))) {
+		spin_lock(&zbpg_unused_list_spinlock);
+		zcache_zbpg_unused_contended++;
+	}
+}
+
+/* move up to nr unused zbpgs from the global list to a cpu's cache */
+static void zbud_pcpu_refill(struct zbud_pcpu *zp, int nr)
+{
+	ASSERT_SPINLOCK(&zp->lock);
+	zbpg_unused_lock();
+	while (nr-- > 0 && !list_empty(&zbpg_unused_list)) {
+		list_move(zbpg_unused_list.next, &zp->unused);
+		zcache_zbpg_unused_list_count--;
+		zp->unused_count++;
+	}
+	spin_unlock(&zbpg_unused_list_spinlock);
+}
+
+/* and back; nr < 0 drains the cache */
+static void zbud_pcpu_drain(struct zbud_pcpu *zp, int nr)
+{
+	ASSERT_SPINLOCK(&zp->lock);
+	zbpg_unused_lock();
+	while (nr-- != 0 && !list_empty(&zp->unused)) {
+		list_move(zp->unused.next, &zbpg_unused_list);
+		zcache_zbpg_unused_list_count++;
+		zp->unused_count--;
+	}
+	spin_unlock(&zbpg_unused_list_spinlock);
+}
+
+static struct zbud_page *zbud_alloc_raw_page(struct zbud_pcpu *zp)
 {
 	struct zbud_page *zbpg = NULL;
 	struct zbud_hdr *zh0, *zh1;
 	bool recycled = 0;
 
-	/* if any pages on the zbpg list, use one */
-	spin_lock(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		zbpg = list_first_entry(&zbpg_unused_list,
+	/* if any pages on this cpu's or the global zbpg list, use one */
+	zbud_pcpu_lock(zp);
+	if (list_empty(&zp->unused))
+		zbud_pcpu_refill(zp, ZBUD_PCPU_BATCH);
+	else
+		zp->cache_hits++;
+	if (!list_empty(&zp->unused)) {
+		zbpg = list_first_entry(&zp->unused,
 				struct zbud_page, bud_list);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
+		zp->unused_count--;
 		recycled = 1;
 	}
-	spin_unlock(&zbpg_unused_list_spinlock);
+	spin_unlock(&zp->lock);
 	if (zbpg == NULL)
 		/* none on zbpg list, try to get a kernel page */
 		zbpg = zcache_get_free_page();
@@ -257,6 +364,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
 	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+	struct zbud_pcpu *zp;
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
@@ -264,11 +372,14 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
 	INVERT_SENTINEL(zbpg, ZBPG);
+	zp = &get_cpu_var(zbud_pcpu);
 	spin_unlock(&zbpg->lock);
-	spin_lock(&zbpg_unused_list_spinlock);
-	list_add(&zbpg->bud_list, &zbpg_unused_list);
-	zcache_zbpg_unused_list_count++;
-	spin_unlock(&zbpg_unused_list_spinlock);
+	zbud_pcpu_lock(zp);
+	list_add(&zbpg->bud_list, &zp->unused);
+	if (++zp->unused_count > ZBUD_PCPU_HIGH)
+		zbud_pcpu_drain(zp, ZBUD_PCPU_BATCH);
+	spin_unlock(&zp->lock);
+	put_cpu_var(zbud_pcpu);
 }
 
 /*
@@ -298,6 +409,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	unsigned budnum = zbud_budnum(zh), size;
 	struct zbud_page *zbpg =
 		container_of(zh, struct zbud_page, buddy[budnum]);
+	struct zbud_pcpu *zp;
 
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
@@ -308,22 +420,24 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	size = zbud_free(zh);
 	ASSERT_SPINLOCK(&zbpg->lock);
 	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
+	zp = &per_cpu(zbud_pcpu, zbpg->cpu);
+	zbud_pcpu_lock(zp);
+	if (zbpg->cpu != smp_processor_id())
+		zp->remote_frees++;
 	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
 		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
+		BUG_ON(list_empty(&zp->unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
-		spin_unlock(&zbud_budlists_spinlock);
+		zp->unbuddied[chunks].count--;
+		spin_unlock(&zp->lock);
 		zbud_free_raw_page(zbpg);
 	} else { /* was buddied: move remaining buddy to unbuddied list */
 		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
-		spin_unlock(&zbud_budlists_spinlock);
+		zp->buddied_count--;
+		list_add_tail(&zbpg->bud_list, &zp->unbuddied[chunks].list);
+		zp->unbuddied[chunks].count++;
+		spin_unlock(&zp->lock);
 		spin_unlock(&zbpg->lock);
 	}
 }
@@ -334,34 +448,35 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 					void *cdata, unsigned size)
 {
 	struct zbud_hdr *zh0, *zh1, *zh = NULL;
-	struct zbud_page *zbpg = NULL, *ztmp;
+	struct zbud_page *zbpg = NULL;
+	struct zbud_pcpu *zp;
 	unsigned nchunks;
 	char *to;
 	int i, found_good_buddy = 0;
 
+	/* puts run with irqs disabled, so we stay on this cpu */
+	zp = &__get_cpu_var(zbud_pcpu);
 	nchunks = zbud_size_to_chunks(size) ;
+	zbud_pcpu_lock(zp);
 	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
-		spin_lock(&zbud_budlists_spinlock);
-		if (!list_empty(&zbud_unbuddied[i].list)) {
-			list_for_each_entry_safe(zbpg, ztmp,
-				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
-					goto found_unbuddied;
-				}
+		list_for_each_entry(zbpg, &zp->unbuddied[i].list, bud_list) {
+			if (spin_trylock(&zbpg->lock)) {
+				found_good_buddy = i;
+				goto found_unbuddied;
 			}
 		}
-		spin_unlock(&zbud_budlists_spinlock);
 	}
+	spin_unlock(&zp->lock);
 	/* didn't find a good buddy, try allocating a new page */
-	zbpg = zbud_alloc_raw_page();
+	zbpg = zbud_alloc_raw_page(zp);
 	if (unlikely(zbpg == NULL))
 		goto out;
 	/* ok, have a page, now compress the data before taking locks */
 	spin_lock(&zbpg->lock);
-	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
+	zbud_pcpu_lock(zp);
+	zbpg->cpu = smp_processor_id();
+	list_add_tail(&zbpg->bud_list, &zp->unbuddied[nchunks].list);
+	zp->unbuddied[nchunks].count++;
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
@@ -378,9 +493,9 @@ found_unbuddied:
 	} else
 		BUG();
 	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
+	zp->unbuddied[found_good_buddy].count--;
+	list_add_tail(&zbpg->bud_list, &zp->buddied);
+	zp->buddied_count++;
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
@@ -389,8 +504,9 @@ init_zh:
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
 	zh->client_id = client_id;
+	zh->stamp = jiffies;
 	/* can wait to copy the data until the list locks are dropped */
-	spin_unlock(&zbud_budlists_spinlock);
+	spin_unlock(&zp->lock);
 
 	to = zbud_data(zh, size);
 	memcpy(to, cdata, size);
@@ -404,11 +520,14 @@ out:
 	return zh;
 }
 
-static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
+static int zcache_decompress(unsigned int comp, char *from_va,
+				unsigned size, char *to_va);
+
+static int zbud_decompress(struct page *page, struct zbud_hdr *zh,
+				unsigned int comp)
 {
 	struct zbud_page *zbpg;
 	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
@@ -425,9 +544,7 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page, KM_USER0);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
-	BUG_ON(out_len != PAGE_SIZE);
+	ret = zcache_decompress(comp, from_va, size, to_va);
 	kunmap_atomic(to_va, KM_USER0);
 out:
 	spin_unlock(&zbpg->lock);
@@ -442,6 +559,48 @@ out:
 static unsigned long zcache_evicted_raw_pages;
 static unsigned long zcache_evicted_buddied_pages;
 static unsigned long zcache_evicted_unbuddied_pages;
+static unsigned long zcache_evicted_cold_pages;
+
+/*
+ * A zbud is cold when it was put more than zbud_cold_age_ms ago. Gets
+ * from the ephemeral pools zbud backs are exclusive and free the zbud,
+ * so the put time is the only access time there is.
+ * Eviction first looks for zbpgs whose zbuds are all cold, so that a
+ * recently put zbud is not thrown out together with a cold buddy, and
+ * looks at up to ZBUD_COLD_SCAN zbpgs per page to free doing so.
+ */
+static unsigned int zbud_cold_age_ms = 10000;
+#define ZBUD_COLD_SCAN 16
+
+static bool zbud_page_cold(struct zbud_page *zbpg, unsigned long now)
+{
+	unsigned long age = msecs_to_jiffies(zbud_cold_age_ms);
+	int i;
+
+	ASSERT_SPINLOCK(&zbpg->lock);
+	for (i = 0; i < ZBUD_MAX_BUDS; i++)
+		if (zbpg->buddy[i].size &&
+		    time_before(now, zbpg->buddy[i].stamp + age))
+			return false;
+	return true;
+}
+
+/* list NCHUNKS stands for the buddied list */
+static struct list_head *zbud_pcpu_list(struct zbud_pcpu *zp, int i)
+{
+	return i < NCHUNKS ? &zp->unbuddied[i].list : &zp->buddied;
+}
+
+static void zbud_pcpu_unlist(struct zbud_pcpu *zp, struct zbud_page *zbpg,
+				int i)
+{
+	ASSERT_SPINLOCK(&zp->lock);
+	list_del_init(&zbpg->bud_list);
+	if (i < NCHUNKS)
+		zp->unbuddied[i].count--;
+	else
+		zp->buddied_count--;
+}
 
 static struct tmem_pool *zcache_get_pool_by_id(uint16_t cli_id,
 						uint16_t poolid);
@@ -496,9 +655,17 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 static void zbud_evict_pages(int nr)
 {
 	struct zbud_page *zbpg;
-	int i;
-
-	/* first try freeing any pages on unused list */
+	struct zbud_pcpu *zp;
+	unsigned long now;
+	int i, cpu, scan;
+
+	/* first try freeing any unused pages, including the per-cpu ones */
+	for_each_possible_cpu(cpu) {
+		zp = &per_cpu(zbud_pcpu, cpu);
+		spin_lock_bh(&zp->lock);
+		zbud_pcpu_drain(zp, -1);
+		spin_unlock_bh(&zp->lock);
+	}
 retry_unused_list:
 	spin_lock_bh(&zbpg_unused_list_spinlock);
 	if (!list_empty(&zbpg_unused_list)) {
@@ -517,66 +684,111 @@ retry_unused_list:
 	}
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
+	/* then zbpgs whose zbuds are all cold, lists are oldest first */
+	scan = nr * ZBUD_COLD_SCAN;
+	now = jiffies;
+	for_each_possible_cpu(cpu) {
+		zp = &per_cpu(zbud_pcpu, cpu);
+		for (i = 0; i <= NCHUNKS; i++) {
+retry_cold_list_i:
+			spin_lock_bh(&zp->lock);
+			list_for_each_entry(zbpg, zbud_pcpu_list(zp, i),
+					    bud_list) {
+				if (scan-- <= 0) {
+					spin_unlock_bh(&zp->lock);
+					goto evict_warm;
+				}
+				if (unlikely(!spin_trylock(&zbpg->lock)))
+					continue;
+				if (!zbud_page_cold(zbpg, now)) {
+					spin_unlock(&zbpg->lock);
+					continue;
+				}
+				zbud_pcpu_unlist(zp, zbpg, i);
+				spin_unlock(&zp->lock);
+				zcache_evicted_cold_pages++;
+				/* want budlists unlocked when doing eviction */
+				zbud_evict_zbpg(zbpg);
+				local_bh_enable();
+				if (--nr <= 0)
+					goto out;
+				goto retry_cold_list_i;
+			}
+			spin_unlock_bh(&zp->lock);
+		}
+	}
+
+evict_warm:
 	/* now try freeing unbuddied pages, starting with least space avail */
 	for (i = 0; i < MAX_CHUNK; i++) {
+		for_each_possible_cpu(cpu) {
+			zp = &per_cpu(zbud_pcpu, cpu);
 retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
+			spin_lock_bh(&zp->lock);
+			if (list_empty(&zp->unbuddied[i].list)) {
+				spin_unlock_bh(&zp->lock);
+				continue;
+			}
+			list_for_each_entry(zbpg, &zp->unbuddied[i].list,
+					    bud_list) {
+				if (unlikely(!spin_trylock(&zbpg->lock)))
+					continue;
+				list_del_init(&zbpg->bud_list);
+				zp->unbuddied[i].count--;
+				spin_unlock(&zp->lock);
+				zcache_evicted_unbuddied_pages++;
+				/* want budlists unlocked when doing eviction */
+				zbud_evict_zbpg(zbpg);
+				local_bh_enable();
+				if (--nr <= 0)
+					goto out;
+				goto retry_unbud_list_i;
+			}
+			spin_unlock_bh(&zp->lock);
+		}
+	}
+
+	/* as a last resort, free buddied pages */
+	for_each_possible_cpu(cpu) {
+		zp = &per_cpu(zbud_pcpu, cpu);
+retry_bud_list:
+		spin_lock_bh(&zp->lock);
+		if (list_empty(&zp->buddied)) {
+			spin_unlock_bh(&zp->lock);
 			continue;
 		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
+		list_for_each_entry(zbpg, &zp->buddied, bud_list) {
 			if (unlikely(!spin_trylock(&zbpg->lock)))
 				continue;
 			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
+			zp->buddied_count--;
+			spin_unlock(&zp->lock);
+			zcache_evicted_buddied_pages++;
 			/* want budlists unlocked when doing zbpg eviction */
 			zbud_evict_zbpg(zbpg);
 			local_bh_enable();
 			if (--nr <= 0)
 				goto out;
-			goto retry_unbud_list_i;
+			goto retry_bud_list;
 		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
-	}
-
-	/* as a last resort, free buddied pages */
-retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
-		if (unlikely(!spin_trylock(&zbpg->lock)))
-			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
-		/* want budlists unlocked when doing zbpg eviction */
-		zbud_evict_zbpg(zbpg);
-		local_bh_enable();
-		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+		spin_unlock_bh(&zp->lock);
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
 out:
 	return;
 }
 
 static void zbud_init(void)
 {
-	int i;
+	struct zbud_pcpu *zp;
+	int i, cpu;
 
-	INIT_LIST_HEAD(&zbud_buddied_list);
-	zcache_zbud_buddied_count = 0;
-	for (i = 0; i < NCHUNKS; i++) {
-		INIT_LIST_HEAD(&zbud_unbuddied[i].list);
-		zbud_unbuddied[i].count = 0;
+	for_each_possible_cpu(cpu) {
+		zp = &per_cpu(zbud_pcpu, cpu);
+		spin_lock_init(&zp->lock);
+		INIT_LIST_HEAD(&zp->buddied);
+		INIT_LIST_HEAD(&zp->unused);
+		for (i = 0; i < NCHUNKS; i++)
+			INIT_LIST_HEAD(&zp->unbuddied[i].list);
 	}
 }
 
@@ -588,14 +800,75 @@ static void zbud_init(void)
  */
 static int zbud_show_unbuddied_list_counts(char *buf)
 {
-	int i;
+	int i, cpu;
+	unsigned count;
 	char *p = buf;
 
-	for (i = 0; i < NCHUNKS; i++)
-		p += sprintf(p, "%u ", zbud_unbuddied[i].count);
+	for (i = 0; i < NCHUNKS; i++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu(zbud_pcpu, cpu).unbuddied[i].count;
+		p += sprintf(p, "%u ", count);
+	}
 	return p - buf;
 }
 
+/* sums of the per-cpu list counts and contention statistics */
+#define ZBUD_PCPU_SHOW(_field) \
+	static int zbud_show_##_field(char *buf) \
+	{ \
+		unsigned long sum = 0; \
+		int cpu; \
+		for_each_possible_cpu(cpu) \
+			sum += per_cpu(zbud_pcpu, cpu)._field; \
+		return sprintf(buf, "%lu\n", sum); \
+	}
+
+static ssize_t zbud_cold_age_ms_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return sprintf(buf, "%u\n", zbud_cold_age_ms);
+}
+
+static ssize_t zbud_cold_age_ms_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 3600 * MSEC_PER_SEC)
+		return -EINVAL;
+	zbud_cold_age_ms = val;
+	return count;
+}
+
+static struct kobj_attribute zcache_zbud_cold_age_ms_attr = {
+		.attr = { .name = "zbud_cold_age_ms", .mode = 0644 },
+		.show = zbud_cold_age_ms_show,
+		.store = zbud_cold_age_ms_store,
+};
+
+ZBUD_PCPU_SHOW(buddied_count);
+ZBUD_PCPU_SHOW(lock_contended);
+ZBUD_PCPU_SHOW(remote_frees);
+ZBUD_PCPU_SHOW(cache_hits);
+
+static int zbud_show_unused_count(char *buf)
+{
+	unsigned long sum = zcache_zbpg_unused_list_count;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(zbud_pcpu, cpu).unused_count;
+	return sprintf(buf, "%lu\n", sum);
+}
+
 static int zbud_show_cumul_chunk_counts(char *buf)
 {
 	unsigned long i, chunks = 0, total_chunks = 0, sum_total_chunks = 0;
@@ -709,22 +982,18 @@ static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
 	local_irq_restore(flags);
 }
 
-static void zv_decompress(struct page *page, struct zv_hdr *zv)
+static void zv_decompress(struct page *page, struct zv_hdr *zv,
+				unsigned int comp)
 {
-	size_t clen = PAGE_SIZE;
 	char *to_va;
 	unsigned size;
-	int ret;
 
 	ASSERT_SENTINEL(zv, ZVH);
 	size = xv_get_object_size(zv) - sizeof(*zv);
 	BUG_ON(size == 0);
 	to_va = kmap_atomic(page, KM_USER0);
-	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
-					size, to_va, &clen);
+	zcache_decompress(comp, (char *)zv + sizeof(*zv), size, to_va);
 	kunmap_atomic(to_va, KM_USER0);
-	BUG_ON(ret != LZO_E_OK);
-	BUG_ON(clen != PAGE_SIZE);
 }
 
 #ifdef CONFIG_SYSFS
@@ -962,14 +1231,9 @@ out:
 static unsigned long zcache_failed_get_free_pages;
 static unsigned long zcache_failed_alloc;
 static unsigned long zcache_put_to_flush;
-static unsigned long zcache_aborted_preload;
 static unsigned long zcache_aborted_shrink;
 
-/*
- * Ensure that memory allocation requests in zcache don't result
- * in direct reclaim requests via the shrinker, which would cause
- * an infinite loop.  Maybe a GFP flag would be better?
- */
+/* serializes shrinker-driven eviction */
 static DEFINE_SPINLOCK(zcache_direct_reclaim_lock);
 
 /*
@@ -1009,10 +1273,12 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		goto out;
 	if (unlikely(zcache_obj_cache == NULL))
 		goto out;
-	if (!spin_trylock(&zcache_direct_reclaim_lock)) {
-		zcache_aborted_preload++;
-		goto out;
-	}
+	/*
+	 * ZCACHE_GFP_MASK never enters direct reclaim, so preloading does
+	 * not need to exclude the shrinker and cpus preload in parallel.
+	 * Only what the last put used up is allocated again; zbud puts
+	 * often recycle a cached zbpg and leave the page in place.
+	 */
 	preempt_disable();
 	kp = &__get_cpu_var(zcache_preloads);
 	while (kp->nr < ARRAY_SIZE(kp->objnodes)) {
@@ -1021,7 +1287,7 @@ static int zcache_do_preload(struct tmem_pool *pool)
 				ZCACHE_GFP_MASK);
 		if (unlikely(objnode == NULL)) {
 			zcache_failed_alloc++;
-			goto unlock_out;
+			goto out;
 		}
 		preempt_disable();
 		kp = &__get_cpu_var(zcache_preloads);
@@ -1030,31 +1296,35 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		else
 			kmem_cache_free(zcache_objnode_cache, objnode);
 	}
-	preempt_enable_no_resched();
-	obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
-	if (unlikely(obj == NULL)) {
-		zcache_failed_alloc++;
-		goto unlock_out;
+	while (kp->obj == NULL) {
+		preempt_enable_no_resched();
+		obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
+		if (unlikely(obj == NULL)) {
+			zcache_failed_alloc++;
+			goto out;
+		}
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->obj == NULL)
+			kp->obj = obj;
+		else
+			kmem_cache_free(zcache_obj_cache, obj);
 	}
-	page = (void *)__get_free_page(ZCACHE_GFP_MASK);
-	if (unlikely(page == NULL)) {
-		zcache_failed_get_free_pages++;
-		kmem_cache_free(zcache_obj_cache, obj);
-		goto unlock_out;
+	while (kp->page == NULL) {
+		preempt_enable_no_resched();
+		page = (void *)__get_free_page(ZCACHE_GFP_MASK);
+		if (unlikely(page == NULL)) {
+			zcache_failed_get_free_pages++;
+			goto out;
+		}
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->page == NULL)
+			kp->page = page;
+		else
+			free_page((unsigned long)page);
 	}
-	preempt_disable();
-	kp = &__get_cpu_var(zcache_preloads);
-	if (kp->obj == NULL)
-		kp->obj = obj;
-	else
-		kmem_cache_free(zcache_obj_cache, obj);
-	if (kp->page == NULL)
-		kp->page = page;
-	else
-		free_page((unsigned long)page);
 	ret = 0;
-unlock_out:
-	spin_unlock(&zcache_direct_reclaim_lock);
 out:
 	return ret;
 }
@@ -1148,7 +1418,8 @@ static atomic_t zcache_curr_pers_pampd_count = ATOMIC_INIT(0);
 static unsigned long zcache_curr_pers_pampd_count_max;
 
 /* forward reference */
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
+static int zcache_compress(unsigned int comp, struct page *from,
+				void **out_va, size_t *out_len);
 
 static void *zcache_pampd_create(char *data, size_t size, bool raw, int eph,
 				struct tmem_pool *pool, struct tmem_oid *oid,
@@ -1166,7 +1437,8 @@ static void *zcache_pampd_create(char *data, size_t size, bool raw, int eph,
 	u64 total_zsize;
 
 	if (eph) {
-		ret = zcache_compress(page, &cdata, &clen);
+		ret = zcache_compress(zcache_pool_comp(pool), page,
+					&cdata, &clen);
 		if (ret == 0)
 			goto out;
 		if (clen == 0 || clen > zbud_max_buddy_size()) {
@@ -1186,7 +1458,8 @@ static void *zcache_pampd_create(char *data, size_t size, bool raw, int eph,
 		if (curr_pers_pampd_count >
 		    (zv_page_count_policy_percent * totalram_pages) / 100)
 			goto out;
-		ret = zcache_compress(page, &cdata, &clen);
+		ret = zcache_compress(zcache_pool_comp(pool), page,
+					&cdata, &clen);
 		if (ret == 0)
 			goto out;
 		/* reject if compression is too poor */
@@ -1227,7 +1500,7 @@ static int zcache_pampd_get_data(char *data, size_t *bufsize, bool raw,
 	int ret = 0;
 
 	BUG_ON(is_ephemeral(pool));
-	zv_decompress((struct page *)(data), pampd);
+	zv_decompress((struct page *)(data), pampd, zcache_pool_comp(pool));
 	return ret;
 }
 
@@ -1239,10 +1512,11 @@ static int zcache_pampd_get_data_and_free(char *data, size_t *bufsize, bool raw,
 					void *pampd, struct tmem_pool *pool,
 					struct tmem_oid *oid, uint32_t index)
 {
-	int ret = 0;
+	int ret;
 
 	BUG_ON(!is_ephemeral(pool));
-	zbud_decompress((struct page *)(data), pampd);
+	ret = zbud_decompress((struct page *)(data), pampd,
+				zcache_pool_comp(pool));
 	zbud_free_and_delist((struct zbud_hdr *)pampd);
 	atomic_dec(&zcache_curr_eph_pampd_count);
 	return ret;
@@ -1301,32 +1575,110 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
+#define ZCACHE_DSTMEM_PAGE_ORDER 1
 static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
 
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
+/*
+ * Transforms are allocated for every online cpu once a compressor is
+ * selected, and kept while zcache may still hold pages compressed with
+ * it. Both are protected by the cpu hotplug lock.
+ */
+static DEFINE_PER_CPU(struct crypto_comp * [ZCACHE_MAX_BACKENDS], zcache_tfms);
+static unsigned long zcache_comp_enabled;
+
+static int zcache_compress(unsigned int comp, struct page *from,
+				void **out_va, size_t *out_len)
 {
 	int ret = 0;
 	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
+	struct crypto_comp *tfm = __get_cpu_var(zcache_tfms)[comp];
+	unsigned int dlen = PAGE_SIZE << ZCACHE_DSTMEM_PAGE_ORDER;
 	char *from_va;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
+	if (unlikely(dmem == NULL || tfm == NULL))
 		goto out;  /* no buffer, so can't compress */
 	from_va = kmap_atomic(from, KM_USER0);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
-	*out_va = dmem;
+	ret = crypto_comp_compress(tfm, from_va, PAGE_SIZE, dmem, &dlen);
 	kunmap_atomic(from_va, KM_USER0);
+	if (ret) {
+		/* does not fit in dstmem, treat as poorly compressible */
+		ret = 0;
+		goto out;
+	}
+	*out_va = dmem;
+	*out_len = dlen;
 	ret = 1;
 out:
 	return ret;
 }
 
+static int zcache_decompress(unsigned int comp, char *from_va,
+				unsigned size, char *to_va)
+{
+	unsigned int out_len = PAGE_SIZE;
+	struct crypto_comp *tfm = get_cpu_var(zcache_tfms)[comp];
+	int ret;
+
+	ret = crypto_comp_decompress(tfm, from_va, size, to_va, &out_len);
+	put_cpu_var(zcache_tfms);
+	BUG_ON(ret != 0);
+	BUG_ON(out_len != PAGE_SIZE);
+	return ret;
+}
+
+static int zcache_alloc_tfms(int cpu)
+{
+	struct crypto_comp *tfm;
+	unsigned int i;
+
+	for (i = 0; i < ZCACHE_MAX_BACKENDS; i++) {
+		if (!test_bit(i, &zcache_comp_enabled) ||
+		    per_cpu(zcache_tfms, cpu)[i] != NULL)
+			continue;
+		tfm = crypto_alloc_comp(zcache_backends[i], 0, 0);
+		if (IS_ERR(tfm))
+			return PTR_ERR(tfm);
+		per_cpu(zcache_tfms, cpu)[i] = tfm;
+	}
+	return 0;
+}
+
+static void zcache_free_tfms(int cpu)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZCACHE_MAX_BACKENDS; i++) {
+		if (per_cpu(zcache_tfms, cpu)[i] != NULL)
+			crypto_free_comp(per_cpu(zcache_tfms, cpu)[i]);
+		per_cpu(zcache_tfms, cpu)[i] = NULL;
+	}
+}
+
+/*
+ * Make comp usable on all cpus. Pools keep their compressor for their
+ * lifetime, so a compressor is never disabled again.
+ */
+static int zcache_enable_comp(unsigned int comp)
+{
+	int cpu, ret = 0;
+
+	get_online_cpus();
+	if (test_and_set_bit(comp, &zcache_comp_enabled))
+		goto out;
+	for_each_online_cpu(cpu) {
+		ret = zcache_alloc_tfms(cpu);
+		if (ret) {
+			clear_bit(comp, &zcache_comp_enabled);
+			break;
+		}
+	}
+out:
+	put_online_cpus();
+	return ret;
+}
+
 
 static int zcache_cpu_notifier(struct notifier_block *nb,
 				unsigned long action, void *pcpu)
@@ -1338,18 +1690,23 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 	case CPU_UP_PREPARE:
 		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
 			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			ZCACHE_DSTMEM_PAGE_ORDER);
+		/* a cpu without transforms could not decompress pages */
+		if (zcache_alloc_tfms(cpu)) {
+			/* no CPU_UP_CANCELED is sent to the failing notifier */
+			zcache_free_tfms(cpu);
+			free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
+				   ZCACHE_DSTMEM_PAGE_ORDER);
+			per_cpu(zcache_dstmem, cpu) = NULL;
+			return notifier_from_errno(-ENOMEM);
+		}
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
 		free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
-				LZO_DSTMEM_PAGE_ORDER);
+				ZCACHE_DSTMEM_PAGE_ORDER);
 		per_cpu(zcache_dstmem, cpu) = NULL;
-		kfree(per_cpu(zcache_workmem, cpu));
-		per_cpu(zcache_workmem, cpu) = NULL;
+		zcache_free_tfms(cpu);
 		kp = &per_cpu(zcache_preloads, cpu);
 		while (kp->nr) {
 			kmem_cache_free(zcache_objnode_cache,
@@ -1415,15 +1772,14 @@ ZCACHE_SYSFS_RO(failed_pers_puts);
 ZCACHE_SYSFS_RO(zbud_curr_zbytes);
 ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
-ZCACHE_SYSFS_RO(zbud_buddied_count);
-ZCACHE_SYSFS_RO(zbpg_unused_list_count);
+ZCACHE_SYSFS_RO(zbpg_unused_contended);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
 ZCACHE_SYSFS_RO(evicted_buddied_pages);
+ZCACHE_SYSFS_RO(evicted_cold_pages);
 ZCACHE_SYSFS_RO(failed_get_free_pages);
 ZCACHE_SYSFS_RO(failed_alloc);
 ZCACHE_SYSFS_RO(put_to_flush);
-ZCACHE_SYSFS_RO(aborted_preload);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
 ZCACHE_SYSFS_RO(mean_compress_poor);
@@ -1431,6 +1787,11 @@ ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
 ZCACHE_SYSFS_RO_ATOMIC(curr_objnode_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_buddied_count, zbud_show_buddied_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbpg_unused_list_count, zbud_show_unused_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_lock_contended, zbud_show_lock_contended);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_remote_frees, zbud_show_remote_frees);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_pcpu_cache_hits, zbud_show_cache_hits);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
@@ -1440,6 +1801,52 @@ ZCACHE_SYSFS_RO_CUSTOM(zv_curr_dist_counts,
 ZCACHE_SYSFS_RO_CUSTOM(zv_cumul_dist_counts,
 			zv_cumul_dist_counts_show);
 
+static ssize_t zcache_compressor_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	unsigned int i;
+	ssize_t len = 0;
+
+	for (i = 0; i < ZCACHE_MAX_BACKENDS; i++) {
+		if (i == zcache_comp)
+			len += sprintf(buf + len, "[%s] ", zcache_backends[i]);
+		else if (crypto_has_comp(zcache_backends[i], 0, 0))
+			len += sprintf(buf + len, "%s ", zcache_backends[i]);
+	}
+	buf[len - 1] = '\n';
+	return len;
+}
+
+/* only affects pools created after the change */
+static ssize_t zcache_compressor_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	char name[CRYPTO_MAX_ALG_NAME];
+	int comp, err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	strlcpy(name, buf, sizeof(name));
+	comp = zcache_comp_lookup(strim(name));
+	if (comp < 0)
+		return -EINVAL;
+	if (zcache_enabled) {
+		err = zcache_enable_comp(comp);
+		if (err)
+			return err;
+	}
+	zcache_comp = comp;
+	return count;
+}
+
+static struct kobj_attribute zcache_compressor_attr = {
+		.attr = { .name = "compressor", .mode = 0644 },
+		.show = zcache_compressor_show,
+		.store = zcache_compressor_store,
+};
+
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
@@ -1460,13 +1867,18 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_zbud_cumul_zbytes_attr.attr,
 	&zcache_zbud_buddied_count_attr.attr,
 	&zcache_zbpg_unused_list_count_attr.attr,
+	&zcache_zbpg_unused_contended_attr.attr,
+	&zcache_zbud_lock_contended_attr.attr,
+	&zcache_zbud_remote_frees_attr.attr,
+	&zcache_zbud_pcpu_cache_hits_attr.attr,
 	&zcache_evicted_raw_pages_attr.attr,
 	&zcache_evicted_unbuddied_pages_attr.attr,
 	&zcache_evicted_buddied_pages_attr.attr,
+	&zcache_evicted_cold_pages_attr.attr,
+	&zcache_zbud_cold_age_ms_attr.attr,
 	&zcache_failed_get_free_pages_attr.attr,
 	&zcache_failed_alloc_attr.attr,
 	&zcache_put_to_flush_attr.attr,
-	&zcache_aborted_preload_attr.attr,
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
@@ -1475,6 +1887,7 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_zv_max_zsize_attr.attr,
 	&zcache_zv_max_mean_zsize_attr.attr,
 	&zcache_zv_page_count_policy_percent_attr.attr,
+	&zcache_compressor_attr.attr,
 	NULL,
 };
 
@@ -1648,7 +2061,7 @@ static int zcache_destroy_pool(int cli_id, int pool_id)
 	local_bh_disable();
 	ret = tmem_destroy_pool(pool);
 	local_bh_enable();
-	kfree(pool);
+	kfree(container_of(pool, struct zcache_pool, tmem));
 	pr_info("zcache: destroyed pool id=%d, cli_id=%d\n",
 			pool_id, cli_id);
 out:
@@ -1658,6 +2071,7 @@ out:
 static int zcache_new_pool(uint16_t cli_id, uint32_t flags)
 {
 	int poolid = -1;
+	struct zcache_pool *zpool;
 	struct tmem_pool *pool;
 	struct zcache_client *cli = NULL;
 
@@ -1668,18 +2082,20 @@ static int zcache_new_pool(uint16_t cli_id, uint32_t flags)
 	if (cli == NULL)
 		goto out;
 	atomic_inc(&cli->refcount);
-	pool = kmalloc(sizeof(struct tmem_pool), GFP_KERNEL);
-	if (pool == NULL) {
+	zpool = kmalloc(sizeof(struct zcache_pool), GFP_KERNEL);
+	if (zpool == NULL) {
 		pr_info("zcache: pool creation failed: out of memory\n");
 		goto out;
 	}
+	pool = &zpool->tmem;
+	zpool->comp = zcache_comp;
 
 	for (poolid = 0; poolid < MAX_POOLS_PER_CLIENT; poolid++)
 		if (cli->tmem_pools[poolid] == NULL)
 			break;
 	if (poolid >= MAX_POOLS_PER_CLIENT) {
 		pr_info("zcache: pool creation failed: max exceeded\n");
-		kfree(pool);
+		kfree(zpool);
 		poolid = -1;
 		goto out;
 	}
@@ -1688,9 +2104,9 @@ static int zcache_new_pool(uint16_t cli_id, uint32_t flags)
 	pool->pool_id = poolid;
 	tmem_new_pool(pool, flags);
 	cli->tmem_pools[poolid] = pool;
-	pr_info("zcache: created %s tmem pool, id=%d, client=%d\n",
+	pr_info("zcache: created %s tmem pool, id=%d, client=%d, %s\n",
 		flags & TMEM_POOL_PERSIST ? "persistent" : "ephemeral",
-		poolid, cli_id);
+		poolid, cli_id, zcache_backends[zpool->comp]);
 out:
 	if (cli != NULL)
 		atomic_dec(&cli->refcount);
@@ -1903,11 +2319,14 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
  * NOTHING HAPPENS!
  */
 
-static int zcache_enabled;
+/* "zcache" or "zcache=<compressor>" */
+static char zcache_comp_name[CRYPTO_MAX_ALG_NAME] __initdata;
 
 static int __init enable_zcache(char *s)
 {
 	zcache_enabled = 1;
+	if (*s == '=')
+		strlcpy(zcache_comp_name, s + 1, sizeof(zcache_comp_name));
 	return 1;
 }
 __setup("zcache", enable_zcache);
@@ -1949,6 +2368,18 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		if (zcache_comp_name[0]) {
+			int comp = zcache_comp_lookup(zcache_comp_name);
+
+			if (comp < 0)
+				pr_warning("zcache: %s not available, "
+					"using %s\n", zcache_comp_name,
+					zcache_backends[zcache_comp]);
+			else
+				zcache_comp = comp;
+		}
+		set_bit(zcache_comp, &zcache_comp_enabled);
+
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
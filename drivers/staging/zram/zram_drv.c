@@ -29,9 +29,15 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -104,6 +110,182 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+/* Compressors known to the crypto API that zram offers */
+const char * const zram_backends[ZRAM_MAX_BACKENDS] = {
+	"lzo",
+	"lz4",
+	"deflate",
+};
+
+static void zram_strm_free(struct zram_strm *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_strm *zram_strm_alloc(struct zram *zram)
+{
+	struct zram_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zram_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Allocate streams up to max_strm. Transforms are allocated with
+ * GFP_KERNEL, which could recurse into zram when it is used for swap,
+ * so this is only done from process context outside of the I/O path:
+ * at init and when max_comp_streams is raised.
+ */
+static int zram_strm_grow(struct zram *zram)
+{
+	struct zram_strm *zstrm;
+
+	spin_lock(&zram->strm_lock);
+	while (zram->avail_strm < zram->max_strm) {
+		zram->avail_strm++;
+		spin_unlock(&zram->strm_lock);
+
+		zstrm = zram_strm_alloc(zram);
+
+		spin_lock(&zram->strm_lock);
+		if (!zstrm) {
+			zram->avail_strm--;
+			break;
+		}
+		list_add(&zstrm->list, &zram->idle_strm);
+		wake_up(&zram->strm_wait);
+	}
+	spin_unlock(&zram->strm_lock);
+
+	return zram->avail_strm ? 0 : -ENOMEM;
+}
+
+/*
+ * Get an idle compression stream, waiting for another reader or
+ * writer to release one if needed. At least one stream always exists
+ * once the device is set up.
+ */
+static struct zram_strm *zram_strm_find(struct zram *zram)
+{
+	struct zram_strm *zstrm;
+
+	while (1) {
+		spin_lock(&zram->strm_lock);
+		if (!list_empty(&zram->idle_strm)) {
+			zstrm = list_first_entry(&zram->idle_strm,
+						 struct zram_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&zram->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&zram->strm_lock);
+
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+	}
+}
+
+static void zram_strm_release(struct zram *zram, struct zram_strm *zstrm)
+{
+	spin_lock(&zram->strm_lock);
+	if (zram->avail_strm <= zram->max_strm) {
+		list_add(&zstrm->list, &zram->idle_strm);
+		spin_unlock(&zram->strm_lock);
+		wake_up(&zram->strm_wait);
+		return;
+	}
+
+	/* max_strm was lowered while this stream was in use */
+	zram->avail_strm--;
+	spin_unlock(&zram->strm_lock);
+	zram_strm_free(zstrm);
+}
+
+/*
+ * Free idle streams beyond max_strm. Streams in use are freed when
+ * they are released.
+ */
+static void zram_strm_trim(struct zram *zram, int max_strm)
+{
+	struct zram_strm *zstrm;
+	LIST_HEAD(victims);
+
+	spin_lock(&zram->strm_lock);
+	while (zram->avail_strm > max_strm &&
+	       !list_empty(&zram->idle_strm)) {
+		zstrm = list_first_entry(&zram->idle_strm,
+					 struct zram_strm, list);
+		list_move(&zstrm->list, &victims);
+		zram->avail_strm--;
+	}
+	spin_unlock(&zram->strm_lock);
+
+	while (!list_empty(&victims)) {
+		zstrm = list_first_entry(&victims, struct zram_strm, list);
+		list_del(&zstrm->list);
+		zram_strm_free(zstrm);
+	}
+}
+
+int zram_set_max_strm(struct zram *zram, int max_strm)
+{
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	spin_lock(&zram->strm_lock);
+	zram->max_strm = max_strm;
+	spin_unlock(&zram->strm_lock);
+
+	zram_strm_trim(zram, max_strm);
+	if (zram->init_done)
+		ret = zram_strm_grow(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+/*
+ * Decompress an object into a full page. Some transforms keep state,
+ * so the caller provides a stream to use.
+ */
+static int zram_decompress(struct zram *zram, struct zram_strm *zstrm,
+			   u32 index, unsigned char *mem)
+{
+	int ret;
+	unsigned int clen = PAGE_SIZE;
+	unsigned long handle;
+	unsigned char *cmem;
+
+	handle = zram->table[index].entry->handle;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem,
+				     zram->table[index].size, mem, &clen);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	if (!ret && clen != PAGE_SIZE)
+		ret = -EINVAL;
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	}
+
+	return ret;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,15 +315,210 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously read or write one page of the backing device */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long block, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = block << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	if (!ret)
+		zram_stat64_inc(zram, rw == READ ? &zram->stats.bd_reads :
+						   &zram->stats.bd_writes);
+	return ret;
+}
+
+/*
+ * Block 0 of the backing device is never handed out, so that a table
+ * entry of 0 still means an empty slot.
+ */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long block;
+
+	spin_lock(&zram->bitmap_lock);
+	block = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (block < zram->nr_blocks)
+		__set_bit(block, zram->bitmap);
+	else
+		block = 0;
+	spin_unlock(&zram->bitmap_lock);
+
+	return block;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long block)
+{
+	spin_lock(&zram->bitmap_lock);
+	__clear_bit(block, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long block;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *zw = container_of(work, struct zram_bdev_work,
+						 work);
+
+	zw->ret = zram_bdev_rw(zw->zram, zw->page, zw->block, READ);
+}
+
+/*
+ * Read a page that lives on the backing device into mem.  Inside
+ * zram_make_request, current->bio_list holds back any bio we submit
+ * until we return, so the read is done from a worker.
+ */
+static int zram_bdev_read(struct zram *zram, u32 index, void *mem)
+{
+	struct zram_bdev_work zw;
+	int ret;
+
+	zw.page = alloc_page(GFP_NOIO);
+	if (!zw.page)
+		return -ENOMEM;
+	zw.zram = zram;
+	zw.block = zram->table[index].block;
+
+	INIT_WORK_ONSTACK(&zw.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	ret = zw.ret;
+	if (!ret)
+		memcpy(mem, page_address(zw.page), PAGE_SIZE);
+	__free_page(zw.page);
+
+	if (ret)
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       ret, index);
+	return ret;
+}
+#endif
+
+static struct zram_hash *zram_hash_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+/*
+ * Look for a stored object with the same compressed contents, and take
+ * a reference on it if there is one. Compressing identical pages gives
+ * identical data, so this finds duplicate pages.
+ */
+static struct zram_entry *zram_dedup_get(struct zram *zram,
+					 unsigned char *src, size_t len,
+					 u32 checksum)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, checksum);
+	struct zram_entry *entry;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int match;
+
+	spin_lock(&hash->lock);
+	hlist_for_each_entry(entry, pos, &hash->head, node) {
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, src, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	hlist_add_head(&entry->node, &hash->head);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Drop a slot's reference on its object, freeing the object with the
+ * last one. Returns 1 if the object was freed.
+ */
+static int zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, entry->checksum);
+	unsigned int refcount;
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		hlist_del(&entry->node);
+	spin_unlock(&hash->lock);
+
+	if (refcount)
+		return 0;
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+	return 1;
+}
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
-
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	struct zram_entry *entry = zram->table[index].entry;
+
+	/* Any pending writeback of the old contents is now stale */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_block(zram, zram->table[index].block);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.bd_count);
+		zram->table[index].block = 0;
+		return;
+	}
+#endif
 
-	if (unlikely(!page)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -155,26 +532,31 @@ static void zram_free_page(struct zram *zram, size_t index)
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	if (!zram_entry_put(zram, entry)) {
+		/* Other slots still use the object */
+		zram_stat_dec(&zram->stats.pages_dup);
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, clen);
+		zram_stat_dec(&zram->stats.pages_stored);
+		goto clear;
+	}
+
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+	zram->table[index].entry = NULL;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct bio_vec *bvec)
@@ -210,72 +592,92 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int handle_bdev_page(struct zram *zram, struct bio_vec *bvec,
+			    u32 index, int offset)
+{
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem, *uncmem;
+	int ret;
+
+	uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+	if (!uncmem) {
+		pr_info("Error allocating temp memory!\n");
+		return -ENOMEM;
+	}
+
+	ret = zram_bdev_read(zram, index, uncmem);
+	if (ret) {
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		goto out;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	memcpy(user_mem + bvec->bv_offset, uncmem + offset, bvec->bv_len);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	flush_dcache_page(page);
+out:
+	kfree(uncmem);
+	return ret;
+}
+#endif
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem, *uncmem = NULL;
+	struct zram_strm *zstrm;
+	unsigned char *user_mem;
 
 	page = bvec->bv_page;
 
+	if (zram_test_flag(zram, index, ZRAM_IDLE))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 		handle_zero_page(bvec);
 		return 0;
 	}
 
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	if (unlikely(!zram->table[index].entry)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
 		handle_zero_page(bvec);
 		return 0;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB))
+		return handle_bdev_page(zram, bvec, index, offset);
+#endif
+
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
 		return 0;
 	}
 
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
-	}
-
+	zstrm = zram_strm_find(zram);
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (!is_partial_io(bvec))
-		uncmem = user_mem;
-	clen = PAGE_SIZE;
-
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
-
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    uncmem, &clen);
 
+	/* Partial reads decompress into the stream's buffer */
 	if (is_partial_io(bvec)) {
-		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
-		       bvec->bv_len);
-		kfree(uncmem);
+		ret = zram_decompress(zram, zstrm, index, zstrm->buffer);
+		if (!ret)
+			memcpy(user_mem + bvec->bv_offset,
+			       zstrm->buffer + offset, bvec->bv_len);
+	} else {
+		ret = zram_decompress(zram, zstrm, index, user_mem);
 	}
 
-	kunmap_atomic(cmem, KM_USER1);
 	kunmap_atomic(user_mem, KM_USER0);
+	zram_strm_release(zram, zstrm);
 
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	if (unlikely(ret))
 		return ret;
-	}
 
 	flush_dcache_page(page);
 
@@ -285,55 +687,59 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
 	unsigned char *cmem;
+	struct zram_strm *zstrm;
 
 	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
+	    !zram->table[index].entry) {
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER0) +
-		zram->table[index].offset;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB))
+		return zram_bdev_read(zram, index, mem);
+#endif
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].page, KM_USER0);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem, KM_USER0);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    mem, &clen);
-	kunmap_atomic(cmem, KM_USER0);
+	zstrm = zram_strm_find(zram);
+	ret = zram_decompress(zram, zstrm, index, mem);
+	zram_strm_release(zram, zstrm);
 
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
-	}
-
-	return 0;
+	return ret;
 }
 
+/*
+ * For full page writes only the table update is done under zram->lock.
+ * Compression uses a stream of its own and allocation may sleep, so
+ * concurrent writers compress in parallel. A partial write holds the
+ * lock from reading the old page until the new one is in the table, so
+ * that writes to other sectors of the same page are not lost.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
-	size_t clen;
-	struct zobj_header *zheader;
+	int partial = is_partial_io(bvec);
+	int uncompressed = 0, dup = 0;
+	unsigned long handle;
+	u32 checksum;
+	unsigned int clen = 2 * PAGE_SIZE;
+	struct zram_entry *entry = NULL;
+	struct zram_strm *zstrm;
 	struct page *page, *page_store;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
-	if (is_partial_io(bvec)) {
+	if (partial) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
@@ -342,8 +748,9 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
-			goto out;
+			goto fail;
 		}
+		down_write(&zram->lock);
 		ret = zram_read_before_write(zram, uncmem, index);
 		if (ret) {
 			kfree(uncmem);
@@ -351,17 +758,12 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	zstrm = zram_strm_find(zram);
+	src = zstrm->buffer;
 
 	user_mem = kmap_atomic(page, KM_USER0);
 
-	if (is_partial_io(bvec))
+	if (partial)
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
 	else
@@ -369,22 +771,33 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		if (is_partial_io(bvec))
+		if (partial)
 			kfree(uncmem);
+		zram_strm_release(zram, zstrm);
+
+		if (!partial)
+			down_write(&zram->lock);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		if (zram->table[index].entry ||
+		    zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
+		up_write(&zram->lock);
+		return 0;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	ret = crypto_comp_compress(zstrm->tfm, uncmem, PAGE_SIZE, src, &clen);
 
 	kunmap_atomic(user_mem, KM_USER0);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (partial)
+		kfree(uncmem);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
+		zram_strm_release(zram, zstrm);
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -398,61 +811,94 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
+			zram_strm_release(zram, zstrm);
 			pr_info("Error allocating memory for "
 				"incompressible page: %u\n", index);
 			ret = -ENOMEM;
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
+		uncompressed = 1;
 		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		zram_strm_release(zram, zstrm);
+		goto update;
 	}
 
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
+	checksum = jhash(src, clen, 0);
+	entry = zram_dedup_get(zram, src, clen, checksum);
+	if (entry) {
+		zram_strm_release(zram, zstrm);
+		dup = 1;
+		goto update;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	handle = zs_malloc(zram->mem_pool, clen);
+	if (!entry || !handle) {
+		if (handle)
+			zs_free(zram->mem_pool, handle);
+		kfree(entry);
+		zram_strm_release(zram, zstrm);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		ret = -ENOMEM;
 		goto out;
 	}
 
-memstore:
-	zram->table[index].offset = store_offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, src, clen);
+	zs_unmap_object(zram->mem_pool, handle);
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->len = clen;
+	entry->refcount = 1;
+	zram_dedup_insert(zram, entry);
+	zram_strm_release(zram, zstrm);
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
-
-	memcpy(cmem, src, clen);
+update:
+	if (!partial)
+		down_write(&zram->lock);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	if (zram->table[index].entry ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	zram->table[index].size = clen;
+	if (unlikely(uncompressed)) {
+		zram->table[index].page = page_store;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	} else {
+		zram->table[index].entry = entry;
+	}
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (dup) {
+		zram_stat_inc(&zram->stats.pages_dup);
+		zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+	} else {
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	}
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
+	up_write(&zram->lock);
 
 	return 0;
 
 out:
-	if (ret)
-		zram_stat64_inc(zram, &zram->stats.failed_writes);
+	if (partial)
+		up_write(&zram->lock);
+fail:
+	zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
 }
 
@@ -466,9 +912,7 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -576,41 +1020,211 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
-void zram_reset_device(struct zram *zram)
+#ifdef CONFIG_ZRAM_WRITEBACK
+#define ZRAM_BDEV_MODE	(FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, ZRAM_BDEV_MODE);
+	vfree(zram->bitmap);
+	kfree(zram->bdev_path);
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->bdev_path = NULL;
+	zram->nr_blocks = 0;
+}
+
+/*
+ * Set the backing device. The device is claimed exclusively until the
+ * zram device is reset, and can only be changed before initialization.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+	char *bdev_path;
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	bdev_path = kstrdup(path, GFP_KERNEL);
+	if (!bdev_path) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	bdev = blkdev_get_by_path(bdev_path, ZRAM_BDEV_MODE, zram);
+	if (IS_ERR(bdev)) {
+		kfree(bdev_path);
+		ret = PTR_ERR(bdev);
+		goto out;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (nr_blocks < 2 || !bitmap) {
+		blkdev_put(bdev, ZRAM_BDEV_MODE);
+		kfree(bdev_path);
+		vfree(bitmap);
+		ret = nr_blocks < 2 ? -EINVAL : -ENOMEM;
+		goto out;
+	}
+
+	zram_reset_bdev(zram);
+	zram->bdev = bdev;
+	zram->bdev_path = bdev_path;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	pr_info("Using %s as backing device, %lu pages\n",
+		bdev_path, nr_blocks - 1);
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+/* Mark every stored page idle, reading or rewriting one clears the mark */
+void zram_mark_idle(struct zram *zram)
 {
 	size_t index;
 
 	mutex_lock(&zram->init_lock);
-	zram->init_done = 0;
+	if (!zram->init_done)
+		goto out;
+
+	down_write(&zram->lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].entry &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+	}
+	up_write(&zram->lock);
+out:
+	mutex_unlock(&zram->init_lock);
+}
+
+/*
+ * Write pages stored uncompressed (huge) or marked idle out to the
+ * backing device and free their memory. The table lock is dropped for
+ * the I/O; a slot rewritten meanwhile loses ZRAM_UNDER_WB and its copy
+ * on the backing device is thrown away.
+ */
+int zram_writeback(struct zram *zram, int huge)
+{
+	enum zram_pageflags want = huge ? ZRAM_UNCOMPRESSED : ZRAM_IDLE;
+	unsigned long block;
+	struct page *page;
+	size_t index;
+	int ret = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev) {
+		ret = -EINVAL;
+		goto out;
+	}
 
-	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		down_write(&zram->lock);
+		if (!zram->table[index].entry ||
+		    zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		    !zram_test_flag(zram, index, want)) {
+			up_write(&zram->lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		block = zram_alloc_block(zram);
+		if (!block) {
+			ret = -ENOSPC;
+			goto clear;
+		}
 
-		if (!page)
+		down_read(&zram->lock);
+		ret = zram_read_before_write(zram, page_address(page), index);
+		up_read(&zram->lock);
+		if (!ret)
+			ret = zram_bdev_rw(zram, page, block, WRITE);
+		if (ret) {
+			zram_free_block(zram, block);
+			goto clear;
+		}
+
+		down_write(&zram->lock);
+		if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			up_write(&zram->lock);
+			zram_free_block(zram, block);
+			continue;
+		}
+		zram_free_page(zram, index);
+		zram->table[index].block = block;
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_stat_inc(&zram->stats.bd_count);
+		up_write(&zram->lock);
+
+		cond_resched();
+	}
+	goto out;
+
+clear:
+	down_write(&zram->lock);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	up_write(&zram->lock);
+out:
+	mutex_unlock(&zram->init_lock);
+	__free_page(page);
+	return ret;
+}
+#endif
+
+void zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	zram->init_done = 0;
+
+	/* Free compression streams, no writer can be using them now */
+	zram_strm_trim(zram, 0);
+
+	/* Free all pages that are still in this zram device */
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!zram->table[index].entry ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(zram->table[index].page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_entry_put(zram, zram->table[index].entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_bdev(zram);
+#endif
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -623,7 +1237,7 @@ void zram_reset_device(struct zram *zram)
 int zram_init_device(struct zram *zram)
 {
 	int ret;
-	size_t num_pages;
+	size_t num_pages, index;
 
 	mutex_lock(&zram->init_lock);
 
@@ -634,17 +1248,11 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	/* Readers and writers rely on at least one stream being available */
+	ret = zram_strm_grow(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression stream\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -658,12 +1266,26 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	/* About four slots per hash chain when the disk is full */
+	zram->hash_size = roundup_pow_of_two(max_t(size_t, num_pages / 4, 1));
+	zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	for (index = 0; index < zram->hash_size; index++) {
+		spin_lock_init(&zram->hash[index].lock);
+		INIT_HLIST_HEAD(&zram->hash[index].head);
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -684,6 +1306,206 @@ fail:
 	return ret;
 }
 
+/*
+ * Compression benchmark, run through the compr_bench sysfs node. For
+ * 1 to max_writers concurrent writers, each writer compresses
+ * ZRAM_BENCH_PAGES copies of a sample page through the device's stream
+ * pool, and the aggregate throughput is stored in bench_kbps.
+ */
+#define ZRAM_BENCH_PAGES	2048
+
+struct zram_bench {
+	struct zram *zram;
+	void *src;
+	struct completion done;
+};
+
+static int zram_bench_thread(void *data)
+{
+	struct zram_bench *bench = data;
+	struct zram_strm *zstrm;
+	unsigned int clen;
+	int i;
+
+	for (i = 0; i < ZRAM_BENCH_PAGES; i++) {
+		zstrm = zram_strm_find(bench->zram);
+		clen = 2 * PAGE_SIZE;
+		crypto_comp_compress(zstrm->tfm, bench->src, PAGE_SIZE,
+				     zstrm->buffer, &clen);
+		zram_strm_release(bench->zram, zstrm);
+		cond_resched();
+	}
+
+	complete_and_exit(&bench->done, 0);
+}
+
+/* Something that compresses to roughly half, like typical anon memory */
+static void zram_bench_fill(unsigned char *src)
+{
+	static const char alphabet[] = "abcdefghijklmnop";
+	u32 seed = 0x2545f491;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = (i & 1) ? 0 : alphabet[seed >> 28];
+	}
+}
+
+int zram_compr_bench(struct zram *zram, int max_writers)
+{
+	struct zram_bench *bench;
+	struct task_struct *task;
+	void *src;
+	ktime_t start;
+	s64 us;
+	int ret = 0;
+	int n, i;
+
+	src = (void *)__get_free_page(GFP_KERNEL);
+	bench = kcalloc(max_writers, sizeof(*bench), GFP_KERNEL);
+	if (!src || !bench) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	zram_bench_fill(src);
+
+	/* Keep the device from being reset under the benchmark */
+	mutex_lock(&zram->init_lock);
+	/* Setting up the device here would fix its disksize */
+	if (!zram->init_done) {
+		ret = -ENXIO;
+		goto out_unlock;
+	}
+	memset(zram->bench_kbps, 0, sizeof(zram->bench_kbps));
+	for (n = 1; n <= max_writers; n++) {
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			bench[i].zram = zram;
+			bench[i].src = src;
+			init_completion(&bench[i].done);
+			task = kthread_run(zram_bench_thread, &bench[i],
+					   "zram_bench/%d", i);
+			if (IS_ERR(task)) {
+				ret = PTR_ERR(task);
+				break;
+			}
+		}
+		while (i--)
+			wait_for_completion(&bench[i].done);
+		if (ret)
+			break;
+
+		us = ktime_us_delta(ktime_get(), start);
+		zram->bench_kbps[n - 1] = div64_u64((u64)n * ZRAM_BENCH_PAGES *
+					(PAGE_SIZE >> 10) * USEC_PER_SEC,
+					max_t(s64, us, 1));
+	}
+out_unlock:
+	mutex_unlock(&zram->init_lock);
+
+out:
+	kfree(bench);
+	free_page((unsigned long)src);
+	return ret;
+}
+
+/*
+ * Compare the available compressors on up to nr_pages pages stored in
+ * the device, or on the benchmark's sample page if there are none.
+ * Each page is compressed and decompressed once by every compressor,
+ * and the average ratio and timings are stored in comp_result.
+ */
+static void zram_compare_one(struct crypto_comp *tfm, unsigned char *samples,
+			     int nr_pages, unsigned char *dst,
+			     struct zram_comp_result *result)
+{
+	unsigned char *src;
+	unsigned int clen, dlen;
+	u64 csize = 0, comp_ns = 0, decomp_ns = 0;
+	ktime_t start;
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		src = samples + i * PAGE_SIZE;
+
+		clen = 2 * PAGE_SIZE;
+		start = ktime_get();
+		if (crypto_comp_compress(tfm, src, PAGE_SIZE, dst, &clen)) {
+			/* would be stored uncompressed */
+			csize += PAGE_SIZE;
+			continue;
+		}
+		comp_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		csize += min_t(unsigned int, clen, PAGE_SIZE);
+
+		dlen = PAGE_SIZE;
+		start = ktime_get();
+		crypto_comp_decompress(tfm, dst, clen, dst + clen, &dlen);
+		decomp_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		cond_resched();
+	}
+
+	result->ratio = div64_u64(csize * 1000, (u64)nr_pages * PAGE_SIZE);
+	result->comp_ns = div64_u64(comp_ns, nr_pages);
+	result->decomp_ns = div64_u64(decomp_ns, nr_pages);
+}
+
+int zram_comp_compare(struct zram *zram, int nr_pages)
+{
+	struct crypto_comp *tfm;
+	unsigned char *samples, *dst;
+	size_t index;
+	int n = 0, i;
+	int ret = 0;
+
+	samples = vmalloc(nr_pages * PAGE_SIZE);
+	dst = (void *)__get_free_pages(GFP_KERNEL, 2);
+	if (!samples || !dst) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Keep the device from being reset under the comparison */
+	mutex_lock(&zram->init_lock);
+	for (index = 0; zram->init_done && n < nr_pages &&
+	     index < zram->disksize >> PAGE_SHIFT; index++) {
+		down_read(&zram->lock);
+		if (zram->table[index].entry &&
+		    !zram_test_flag(zram, index, ZRAM_ZERO) &&
+		    !zram_test_flag(zram, index, ZRAM_WB) &&
+		    !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED) &&
+		    !zram_read_before_write(zram, samples + n * PAGE_SIZE,
+					    index))
+			n++;
+		up_read(&zram->lock);
+	}
+
+	if (!n) {
+		zram_bench_fill(samples);
+		n = 1;
+	}
+
+	memset(zram->comp_result, 0, sizeof(zram->comp_result));
+	for (i = 0; i < ZRAM_MAX_BACKENDS; i++) {
+		if (!crypto_has_comp(zram_backends[i], 0, 0))
+			continue;
+		tfm = crypto_alloc_comp(zram_backends[i], 0, 0);
+		if (IS_ERR(tfm))
+			continue;
+		zram_compare_one(tfm, samples, n, dst, &zram->comp_result[i]);
+		crypto_free_comp(tfm);
+	}
+	mutex_unlock(&zram->init_lock);
+
+out:
+	if (dst)
+		free_pages((unsigned long)dst, 2);
+	vfree(samples);
+	return ret;
+}
+
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
@@ -705,6 +1527,15 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->strm_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	zram->max_strm = num_online_cpus();
+	strlcpy(zram->compressor, ZRAM_DEFAULT_COMPRESSOR,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +28,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -47,14 +37,30 @@ static const unsigned default_disksize_perc_ram = 25;
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
  */
-static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
+static const unsigned max_zpage_size = PAGE_SIZE / 8 * 7;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to the largest
+ * zsmalloc object, ZS_MAX_ALLOC_SIZE less its object header,
+ * otherwise, zs_malloc() would always return failure.
  */
 
+/*
+ * Number of concurrent writers that can benchmark compression through
+ * the compr_bench sysfs node.
+ */
+#define ZRAM_BENCH_MAX_WRITERS	8
+
+/* Compressor used unless another is set through comp_algorithm */
+#define ZRAM_DEFAULT_COMPRESSOR	"lzo"
+
+/*
+ * Compressors listed by comp_algorithm and compared by comp_compare,
+ * and the most pages comp_compare can sample.
+ */
+#define ZRAM_MAX_BACKENDS	3
+#define ZRAM_COMPARE_MAX_PAGES	1024
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -74,15 +80,45 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page lives on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page has not been accessed since it was marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A compressed object. Slots whose pages compress to the same data share
+ * one, found through the device's hash of compressed contents.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;	/* zsmalloc handle */
+	u32 checksum;		/* of the compressed data */
+	u16 len;		/* compressed size in bytes */
+	unsigned int refcount;	/* table slots using this object */
+};
+
+struct zram_hash {
+	spinlock_t lock;	/* protect chain and entry refcounts */
+	struct hlist_head head;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		struct zram_entry *entry;	/* compressed page */
+		struct page *page;	/* ZRAM_UNCOMPRESSED page */
+		unsigned long block;	/* ZRAM_WB page, never 0 */
+	};
+	u16 size;	/* compressed size in bytes */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -99,16 +135,48 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_dup;		/* no. of slots sharing another's object */
+	u64 dup_data_size;	/* compressed bytes saved by sharing */
+	u32 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from it */
+	u64 bd_writes;		/* no. of pages written to it */
+};
+
+/*
+ * Compression stream: a crypto transform for the device's compressor
+ * and an output buffer. Readers and writers take one from the device's
+ * idle list, so up to max_strm pages can be processed in parallel.
+ */
+struct zram_strm {
+	struct crypto_comp *tfm;
+	void *buffer;	/* 2 pages, compression can expand the input */
+	struct list_head list;
+};
+
+/* comp_compare results for one compressor, averaged over the samples */
+struct zram_comp_result {
+	u32 ratio;	/* compressed size, per mille of the input */
+	u32 comp_ns;	/* per page */
+	u32 decomp_ns;	/* per page */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
+	struct zram_hash *hash;	/* compressed objects, by checksum */
+	size_t hash_size;	/* power of two */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * reads and writes */
+	/* compression streams */
+	spinlock_t strm_lock;	/* protect idle_strm and avail_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated */
+	int max_strm;		/* limit on streams, set via sysfs */
+	u32 bench_kbps[ZRAM_BENCH_MAX_WRITERS]; /* compr_bench results */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	struct zram_comp_result comp_result[ZRAM_MAX_BACKENDS];
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +187,14 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device for idle and incompressible pages */
+	struct block_device *bdev;
+	char *bdev_path;
+	unsigned long *bitmap;	/* blocks in use on bdev */
+	unsigned long nr_blocks;
+	spinlock_t bitmap_lock;
+#endif
 
 	struct zram_stats stats;
 };
@@ -131,5 +207,14 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern const char * const zram_backends[ZRAM_MAX_BACKENDS];
+extern int zram_set_max_strm(struct zram *zram, int max_strm);
+extern int zram_compr_bench(struct zram *zram, int max_writers);
+extern int zram_comp_compare(struct zram *zram, int nr_pages);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, int huge);
+#endif
 
 #endif
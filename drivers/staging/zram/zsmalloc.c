@@ -0,0 +1,641 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Size-class allocator for compressed pages. Objects of each class are
+ * packed into zspages of one to four order-0 (possibly highmem) pages,
+ * and zspages are kept on per-class lists by how full they are, so
+ * allocation fills nearly full zspages first and zs_compact() can empty
+ * sparse ones by moving their objects. Callers get an opaque handle that
+ * stays valid when an object moves, and must map an object with
+ * zs_map_object() before touching it.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				   ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Number of pages per zspage that wastes the least space at the end
+ * of the zspage for objects of the given size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					      struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= 3 * max_objects / ZS_FULLNESS_THRESHOLD_FRAC)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move zspage to the fullness list matching its inuse count. Empty
+ * zspages are not on any list. Called with class->lock held.
+ */
+static void fix_fullness_group(struct size_class *class, struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+}
+
+/*
+ * A zspage with free slots, other than skip: almost full ones first,
+ * so that almost empty ones can drain. Called with class->lock held.
+ */
+static struct zspage *find_zspage(struct size_class *class,
+				  struct zspage *skip)
+{
+	struct list_head *head;
+	struct zspage *zspage;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (list_empty(head))
+		return NULL;
+	zspage = list_first_entry(head, struct zspage, list);
+
+	return zspage == skip ? NULL : zspage;
+}
+
+/* Page index within the zspage, and offset within that page, of idx */
+static void obj_location(struct size_class *class, unsigned int idx,
+			 unsigned int *page_idx, unsigned int *offset)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+
+	*page_idx = off >> PAGE_SHIFT;
+	*offset = off & ~PAGE_MASK;
+}
+
+static struct zs_handle *read_obj_header(struct size_class *class,
+					 struct zspage *zspage,
+					 unsigned int idx)
+{
+	unsigned int page_idx, offset;
+	struct zs_obj_header *header;
+	struct zs_handle *handle;
+	void *addr;
+
+	obj_location(class, idx, &page_idx, &offset);
+	addr = kmap_atomic(zspage->pages[page_idx], KM_USER0);
+	header = addr + offset;
+	handle = header->handle;
+	kunmap_atomic(addr, KM_USER0);
+
+	return handle;
+}
+
+static void write_obj_header(struct size_class *class, struct zspage *zspage,
+			     unsigned int idx, struct zs_handle *handle)
+{
+	unsigned int page_idx, offset;
+	struct zs_obj_header *header;
+	void *addr;
+
+	obj_location(class, idx, &page_idx, &offset);
+	addr = kmap_atomic(zspage->pages[page_idx], KM_USER0);
+	header = addr + offset;
+	header->handle = handle;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/*
+ * Copy an object (with its header) between zspages of the same class,
+ * a page-bounded chunk at a time.
+ */
+static void copy_object(struct size_class *class, struct zspage *dst,
+			unsigned int didx, struct zspage *src,
+			unsigned int sidx)
+{
+	unsigned long s_off = (unsigned long)sidx * class->size;
+	unsigned long d_off = (unsigned long)didx * class->size;
+	unsigned int left = class->size;
+
+	while (left) {
+		unsigned int s_in = PAGE_SIZE - (s_off & ~PAGE_MASK);
+		unsigned int d_in = PAGE_SIZE - (d_off & ~PAGE_MASK);
+		unsigned int len = min(left, min(s_in, d_in));
+		void *s_addr, *d_addr;
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT], KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT], KM_USER1);
+		memcpy(d_addr + (d_off & ~PAGE_MASK),
+		       s_addr + (s_off & ~PAGE_MASK), len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += len;
+		d_off += len;
+		left -= len;
+	}
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool, int class_idx)
+{
+	struct size_class *class = &pool->size_class[class_idx];
+	struct zspage *zspage;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class_idx = class_idx;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+/* Called with class->lock held, zspage must be off the fullness lists */
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+
+	atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+	class->zspages--;
+	kfree(zspage);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, used for the handle cache
+ * @flags: allocation flags used to allocate pool pages
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int fg;
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					 class->size;
+	}
+
+	pool->flags = flags;
+	atomic_set(&pool->pages_allocated, 0);
+	atomic_set(&pool->pages_compacted, 0);
+
+	pool->cache_name = kasprintf(GFP_KERNEL, "zs_handle-%s", name);
+	if (!pool->cache_name)
+		goto fail;
+
+	pool->handle_cachep = kmem_cache_create(pool->cache_name,
+					sizeof(struct zs_handle), 0, 0, NULL);
+	if (!pool->handle_cachep)
+		goto fail;
+
+	pool->area = alloc_percpu(struct zs_mapping_area);
+	if (!pool->area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_mapping_area *area = per_cpu_ptr(pool->area, cpu);
+
+		area->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, cpu;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		struct zspage *zspage, *tmp;
+		int fg;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+
+		if (class->zspages)
+			pr_info("Freeing pool with %lu full zspages "
+				"in class %d\n", class->zspages, i);
+	}
+
+	if (pool->area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->area, cpu)->buf);
+		free_percpu(pool->area);
+	}
+	if (pool->handle_cachep)
+		kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool->cache_name);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, a handle to the allocated object is returned, which
+ * must be mapped with zs_map_object() to get at the object. Returns
+ * 0 on failure.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	int class_idx;
+	unsigned int idx;
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE -
+				     sizeof(struct zs_obj_header)))
+		return 0;
+
+	size += sizeof(struct zs_obj_header);
+	class_idx = get_size_class_index(size);
+	class = &pool->size_class[class_idx];
+
+	handle = kmem_cache_alloc(pool->handle_cachep,
+				  pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->pin = 0;
+
+	spin_lock(&class->lock);
+	zspage = find_zspage(class, NULL);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class_idx);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cachep, handle);
+			return 0;
+		}
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	idx = find_first_zero_bit(zspage->used, class->objs_per_zspage);
+	__set_bit(idx, zspage->used);
+	zspage->inuse++;
+	class->objs_inuse++;
+	handle->zspage = zspage;
+	handle->idx = idx;
+	write_obj_header(class, zspage, idx, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	/* Pinning keeps compaction from moving the object under us */
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->pin);
+	zspage = handle->zspage;
+	class = &pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	__clear_bit(handle->idx, zspage->used);
+	zspage->inuse--;
+	class->objs_inuse--;
+	fix_fullness_group(class, zspage);
+	if (zspage->fullness == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+	spin_unlock(&class->lock);
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->pin);
+
+	kmem_cache_free(pool->handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: whether the object is read, written or both
+ *
+ * The object is pinned against compaction and must be unmapped with
+ * zs_unmap_object() before the caller sleeps. Only one object may be
+ * mapped at a time, and the mapping uses the KM_USER1 slot.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct zs_mapping_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int page_idx, offset, first;
+	void *addr;
+
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->pin);
+	zspage = handle->zspage;
+	class = &pool->size_class[zspage->class_idx];
+	obj_location(class, handle->idx, &page_idx, &offset);
+
+	area = this_cpu_ptr(pool->area);
+	area->mm = mm;
+
+	if (offset + class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+		return area->vaddr + offset + sizeof(struct zs_obj_header);
+	}
+
+	/* Object spans two pages, hand out a copy */
+	if (mm != ZS_MM_WO) {
+		first = PAGE_SIZE - offset;
+		addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+		memcpy(area->buf, addr + offset, first);
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(zspage->pages[page_idx + 1], KM_USER1);
+		memcpy(area->buf + first, addr, class->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	return area->buf + sizeof(struct zs_obj_header);
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct zs_mapping_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int page_idx, offset, first;
+	void *addr;
+
+	zspage = handle->zspage;
+	class = &pool->size_class[zspage->class_idx];
+	obj_location(class, handle->idx, &page_idx, &offset);
+	area = this_cpu_ptr(pool->area);
+
+	if (offset + class->size <= PAGE_SIZE) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+		goto out;
+	}
+
+	if (area->mm != ZS_MM_RO) {
+		/* The header is never written through a mapping */
+		first = PAGE_SIZE - offset;
+		addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+		memcpy(addr + offset + sizeof(struct zs_obj_header),
+		       area->buf + sizeof(struct zs_obj_header),
+		       first - sizeof(struct zs_obj_header));
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(zspage->pages[page_idx + 1], KM_USER1);
+		memcpy(addr, area->buf + first, class->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+out:
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->pin);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Move objects out of src into other zspages of the class. Returns
+ * -EBUSY if an object is mapped, and -ENOSPC if there is no room left
+ * in the class. Called with class->lock held.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src)
+{
+	unsigned int sidx = 0, didx;
+	struct zs_handle *handle;
+	struct zspage *dst;
+
+	while ((sidx = find_next_bit(src->used, class->objs_per_zspage,
+				     sidx)) < class->objs_per_zspage) {
+		dst = find_zspage(class, src);
+		if (!dst)
+			return -ENOSPC;
+
+		handle = read_obj_header(class, src, sidx);
+		if (!bit_spin_trylock(ZS_HANDLE_PIN_BIT, &handle->pin))
+			return -EBUSY;
+
+		didx = find_first_zero_bit(dst->used, class->objs_per_zspage);
+		copy_object(class, dst, didx, src, sidx);
+		__set_bit(didx, dst->used);
+		dst->inuse++;
+		__clear_bit(sidx, src->used);
+		src->inuse--;
+		handle->zspage = dst;
+		handle->idx = didx;
+		bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->pin);
+
+		fix_fullness_group(class, dst);
+		sidx++;
+	}
+
+	return 0;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct list_head *head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	struct zspage *src;
+	LIST_HEAD(busy);
+	int ret;
+
+	spin_lock(&class->lock);
+	while (!list_empty(head)) {
+		/* Drain the emptiest zspages, which sit at the tail */
+		src = list_entry(head->prev, struct zspage, list);
+		ret = migrate_zspage(class, src);
+		fix_fullness_group(class, src);
+		if (src->fullness == ZS_EMPTY) {
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+		} else if (ret == -EBUSY &&
+			   src->fullness == ZS_ALMOST_EMPTY) {
+			/* Pinned by a mapping, go on with the others */
+			list_move(&src->list, &busy);
+		}
+		if (ret == -ENOSPC)
+			break;
+
+		if (need_resched()) {
+			spin_unlock(&class->lock);
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+	}
+	list_splice_tail(&busy, head);
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Move objects out of sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Zspages with a mapped object are skipped. Returns the number of pages
+ * freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		freed += compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	atomic_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->obj_size += (u64)class->objs_inuse * class->size;
+		stats->meta_size += (u64)class->zspages *
+					sizeof(struct zspage) +
+				    (u64)class->objs_inuse *
+					(sizeof(struct zs_handle) +
+					 sizeof(struct zs_obj_header));
+		spin_unlock(&class->lock);
+	}
+
+	stats->total_size = zs_get_total_size_bytes(pool);
+	stats->pages_compacted = atomic_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_stats);
@@ -0,0 +1,123 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+
+/* User configurable params */
+
+/*
+ * Objects of a size class are packed back to back into a zspage of
+ * up to ZS_MAX_PAGES_PER_ZSPAGE (not necessarily contiguous) pages, so
+ * an object may span two pages.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes. Both this
+ * and ZS_MIN_ALLOC_SIZE must be multiples of 16, so an object never
+ * starts in the last 16 bytes of a page and its header never spans two
+ * pages.
+ */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES	\
+	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / ZS_SIZE_CLASS_DELTA + 1)
+
+#define ZS_MAX_OBJS_PER_ZSPAGE	\
+	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / ZS_MIN_ALLOC_SIZE)
+
+/* End of user params */
+
+/*
+ * A zspage is almost empty when no more than 3/4 of its objects are in
+ * use. Allocation prefers almost full zspages and compaction drains
+ * almost empty ones into them.
+ */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/*
+ * Every object starts with a back-reference to its handle, so that
+ * compaction can update the handle when it moves the object.
+ */
+struct zs_obj_header {
+	struct zs_handle *handle;
+};
+
+/*
+ * Handles give objects a fixed address. zs_malloc() returns a pointer
+ * to one of these, and only compaction changes zspage and idx, with
+ * the class lock held and the handle pinned.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned int idx;
+	unsigned long pin;	/* bit 0: object is mapped or being freed */
+};
+
+#define ZS_HANDLE_PIN_BIT	0
+
+struct zspage {
+	struct list_head list;		/* on a class fullness list */
+	unsigned int class_idx;
+	unsigned int inuse;
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long used[BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE)];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	unsigned int size;		/* object size, incl. header */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+/*
+ * Objects spanning two pages are copied through a per-cpu buffer while
+ * they are mapped.
+ */
+struct zs_mapping_area {
+	char *buf;
+	void *vaddr;		/* kmap_atomic address, object in one page */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	gfp_t flags;
+	char *cache_name;
+	struct kmem_cache *handle_cachep;
+	struct zs_mapping_area __percpu *area;
+	atomic_t pages_allocated;
+	atomic_t pages_compacted;
+};
+
+#endif
@@ -1096,7 +1096,12 @@ int flush_old_exec(struct linux_binprm * bprm)
 	bprm->mm = NULL;		/* We're using it now */
 
 	set_fs(USER_DS);
-	current->flags &= ~(PF_RANDOMIZE | PF_KTHREAD);
+	if (current->flags & PF_KTHREAD) {
+		/* usermode helpers start out as kernel threads */
+		current->flags &= ~PF_KTHREAD;
+		oom_adj_notify(OOM_ADJ_EXEC, current);
+	}
+	current->flags &= ~PF_RANDOMIZE;
 	flush_thread();
 	current->personality &= ~bprm->per_clear;
 
@@ -32,6 +32,12 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+struct ashmem_pin_vec {
+	__u64 ranges;	/* user pointer to an array of struct ashmem_pin */
+	__u32 count;	/* number of entries in ranges */
+	__u32 reserved;	/* must be zero */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +50,7 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_PIN_VEC		_IOW(__ASHMEMIOC, 11, struct ashmem_pin_vec)
+#define ASHMEM_UNPIN_VEC	_IOW(__ASHMEMIOC, 12, struct ashmem_pin_vec)
 
 #endif	/* _LINUX_ASHMEM_H */
@@ -0,0 +1,39 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  Compressor and decompressor for the LZ4 block format: a fast LZ77
+ *  variant with byte-aligned sequences and no entropy stage. It trades
+ *  some ratio against LZO for considerably faster decompression.
+ *
+ *  The block format is described at:
+ *  http://code.google.com/p/lz4/
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'workmem' of size LZ4_MEM_COMPRESS, and dst must have
+ * room for lz4_compressbound(src_len) bytes.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing. *dst_len is the size of
+ * dst on entry and the decompressed length on return.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK		0
+#define LZ4_E_ERROR		(-1)
+
+#endif
@@ -52,6 +52,18 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask,
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+/* events for oom_adj notifiers */
+enum oom_adj_event {
+	OOM_ADJ_FORK,		/* new thread group, tasklist_lock held */
+	OOM_ADJ_EXIT,		/* thread group released, tasklist_lock held */
+	OOM_ADJ_CHANGED,	/* oom_adj or oom_score_adj changed */
+	OOM_ADJ_EXEC,		/* child of a kernel thread exec'd */
+};
+
+extern int register_oom_adj_notifier(struct notifier_block *nb);
+extern int unregister_oom_adj_notifier(struct notifier_block *nb);
+extern void oom_adj_notify(unsigned long event, struct task_struct *p);
+
 extern bool oom_killer_disabled;
 
 static inline void oom_killer_disable(void)
@@ -0,0 +1,68 @@
+/* include/linux/suspend_time.h
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_SUSPEND_TIME_H
+#define _LINUX_SUSPEND_TIME_H
+
+#include <linux/sched.h>
+#include <linux/types.h>
+
+struct device;
+
+/* Steps of a suspend/resume cycle, in the order they run. Phases are
+ * timed as a whole; the device phases and the early suspend phases are
+ * also broken down per device or handler.
+ */
+enum suspend_time_phase {
+	SUSPEND_PHASE_FREEZE,
+	SUSPEND_PHASE_DPM_SUSPEND,
+	SUSPEND_PHASE_DPM_SUSPEND_NOIRQ,
+	SUSPEND_PHASE_SYSCORE_SUSPEND,
+	SUSPEND_PHASE_SYSCORE_RESUME,
+	SUSPEND_PHASE_DPM_RESUME_NOIRQ,
+	SUSPEND_PHASE_DPM_RESUME,
+	SUSPEND_PHASE_THAW,
+	SUSPEND_PHASE_EARLY_SUSPEND,
+	SUSPEND_PHASE_LATE_RESUME,
+	SUSPEND_PHASE_BACKOFF,
+	SUSPEND_PHASE_COUNT
+};
+
+/* local_clock() keeps working while timekeeping is suspended */
+static inline u64 suspend_time_now(void)
+{
+	return local_clock();
+}
+
+#ifdef CONFIG_SUSPEND_TIME
+void suspend_time_phase(enum suspend_time_phase phase, u64 start, int error);
+void suspend_time_device(struct device *dev, enum suspend_time_phase phase,
+			 u64 start, int error);
+void suspend_time_handler(void *fn, enum suspend_time_phase phase,
+			  unsigned int us);
+void suspend_time_backoff(void);
+#else
+static inline void suspend_time_phase(enum suspend_time_phase phase,
+				      u64 start, int error) {}
+static inline void suspend_time_device(struct device *dev,
+				       enum suspend_time_phase phase,
+				       u64 start, int error) {}
+static inline void suspend_time_handler(void *fn,
+					enum suspend_time_phase phase,
+					unsigned int us) {}
+static inline void suspend_time_backoff(void) {}
+#endif
+
+#endif
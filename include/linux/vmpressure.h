@@ -0,0 +1,18 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/gfp.h>
+
+struct notifier_block;
+
+/*
+ * Reclaim pressure, 0 to 100, computed over a window of scanned pages from
+ * how many of them reclaim managed to free.  Notifiers are called from
+ * process context with the pressure as the event.
+ */
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern int vmpressure_notifier_register(struct notifier_block *nb);
+extern int vmpressure_notifier_unregister(struct notifier_block *nb);
+
+#endif /* __LINUX_VMPRESSURE_H */
@@ -1002,6 +1002,9 @@ static int copy_signal(unsigned long clone_flags, struct task_struct *tsk)
 	sig->oom_adj = current->signal->oom_adj;
 	sig->oom_score_adj = current->signal->oom_score_adj;
 	sig->oom_score_adj_min = current->signal->oom_score_adj_min;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	INIT_LIST_HEAD(&sig->lowmem_node);
+#endif
 
 	mutex_init(&sig->cred_guard_mutex);
 
@@ -1383,6 +1386,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 			list_add_tail(&p->sibling, &p->real_parent->children);
 			list_add_tail_rcu(&p->tasks, &init_task.tasks);
 			__this_cpu_inc(process_counts);
+			oom_adj_notify(OOM_ADJ_FORK, p);
 		}
 		attach_pid(p, PIDTYPE_PID, pid);
 		nr_threads++;
@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
+#include <linux/suspend_time.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -45,6 +49,51 @@ enum {
 };
 static int state;
 
+/* Handlers that asked for it run concurrently with their level */
+static int async_handlers = 1;
+module_param_named(async, async_handlers, int, S_IRUGO | S_IWUSR | S_IWGRP);
+static LIST_HEAD(early_suspend_domain);
+
+/* Time spent running the handlers, in microseconds */
+static unsigned int early_suspend_us;
+static unsigned int late_resume_us;
+
+static void call_suspend_handler(struct early_suspend *h)
+{
+	ktime_t start = ktime_get();
+	unsigned int us;
+
+	h->suspend(h);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	suspend_time_handler(h->suspend, SUSPEND_PHASE_EARLY_SUSPEND, us);
+	h->suspend_us = us;
+	if (us > h->max_suspend_us)
+		h->max_suspend_us = us;
+}
+
+static void call_resume_handler(struct early_suspend *h)
+{
+	ktime_t start = ktime_get();
+	unsigned int us;
+
+	h->resume(h);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	suspend_time_handler(h->resume, SUSPEND_PHASE_LATE_RESUME, us);
+	h->resume_us = us;
+	if (us > h->max_resume_us)
+		h->max_resume_us = us;
+}
+
+static void async_suspend_handler(void *data, async_cookie_t cookie)
+{
+	call_suspend_handler(data);
+}
+
+static void async_resume_handler(void *data, async_cookie_t cookie)
+{
+	call_resume_handler(data);
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -76,6 +125,9 @@ static void early_suspend(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
+	ktime_t start;
+	u64 profile_start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -94,13 +146,27 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	start = ktime_get();
+	profile_start = suspend_time_now();
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
+		if (pos->level != level) {
+			async_synchronize_full_domain(&early_suspend_domain);
+			level = pos->level;
+		}
 		if (pos->suspend != NULL) {
 			if (debug_mask & DEBUG_VERBOSE)
 				pr_info("early_suspend: calling %pf\n", pos->suspend);
-			pos->suspend(pos);
+			if (pos->async && async_handlers)
+				async_schedule_domain(async_suspend_handler,
+						      pos,
+						      &early_suspend_domain);
+			else
+				call_suspend_handler(pos);
 		}
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	early_suspend_us = ktime_to_us(ktime_sub(ktime_get(), start));
+	suspend_time_phase(SUSPEND_PHASE_EARLY_SUSPEND, profile_start, 0);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -119,6 +185,9 @@ static void late_resume(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MAX;
+	ktime_t start;
+	u64 profile_start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -135,14 +204,28 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
+	start = ktime_get();
+	profile_start = suspend_time_now();
 	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
+		if (pos->level != level) {
+			async_synchronize_full_domain(&early_suspend_domain);
+			level = pos->level;
+		}
 		if (pos->resume != NULL) {
 			if (debug_mask & DEBUG_VERBOSE)
 				pr_info("late_resume: calling %pf\n", pos->resume);
 
-			pos->resume(pos);
+			if (pos->async && async_handlers)
+				async_schedule_domain(async_resume_handler,
+						      pos,
+						      &early_suspend_domain);
+			else
+				call_resume_handler(pos);
 		}
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	late_resume_us = ktime_to_us(ktime_sub(ktime_get(), start));
+	suspend_time_phase(SUSPEND_PHASE_LATE_RESUME, profile_start, 0);
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -185,3 +268,54 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_debug_show(struct seq_file *s, void *data)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(s, "early_suspend %u us, late_resume %u us\n",
+		   early_suspend_us, late_resume_us);
+	seq_printf(s, "level async suspend_us max_suspend_us "
+		   "resume_us max_resume_us handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link) {
+		seq_printf(s, "%5d %5d %10u %14u %9u %13u %pf\n",
+			   pos->level, pos->async,
+			   pos->suspend_us, pos->max_suspend_us,
+			   pos->resume_us, pos->max_resume_us,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+	}
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_debug_show, NULL);
+}
+
+static const struct file_operations early_suspend_debug_fops = {
+	.open		= early_suspend_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init early_suspend_debug_init(void)
+{
+	struct dentry *d;
+
+	d = debugfs_create_file("early_suspend_stats", 0444, NULL, NULL,
+		&early_suspend_debug_fops);
+	if (!d) {
+		pr_err("Failed to create early_suspend_stats debug file\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(early_suspend_debug_init);
+#endif
@@ -312,6 +312,7 @@ power_attr(pm_trace_dev_match);
 #ifdef CONFIG_USER_WAKELOCK
 power_attr(wake_lock);
 power_attr(wake_unlock);
+power_attr(wake_lock_batch);
 #endif
 
 static struct attribute * g[] = {
@@ -329,6 +330,7 @@ static struct attribute * g[] = {
 #ifdef CONFIG_USER_WAKELOCK
 	&wake_lock_attr.attr,
 	&wake_unlock_attr.attr,
+	&wake_lock_batch_attr.attr,
 #endif
 #endif
 	NULL,
@@ -22,6 +22,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/suspend.h>
+#include <linux/suspend_time.h>
 #include <linux/syscore_ops.h>
 #include <trace/events/power.h>
 
@@ -92,6 +93,7 @@ static int suspend_test(int level)
 static int suspend_prepare(void)
 {
 	int error;
+	u64 start;
 
 	if (!suspend_ops || !suspend_ops->enter)
 		return -EPERM;
@@ -106,7 +108,9 @@ static int suspend_prepare(void)
 	if (error)
 		goto Finish;
 
+	start = suspend_time_now();
 	error = suspend_freeze_processes();
+	suspend_time_phase(SUSPEND_PHASE_FREEZE, start, error);
 	if (!error)
 		return 0;
 
@@ -140,6 +144,7 @@ void __attribute__ ((weak)) arch_suspend_enable_irqs(void)
 static int suspend_enter(suspend_state_t state, bool *wakeup)
 {
 	int error;
+	u64 start;
 
 	if (suspend_ops->prepare) {
 		error = suspend_ops->prepare();
@@ -147,7 +152,9 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 			goto Platform_finish;
 	}
 
+	start = suspend_time_now();
 	error = dpm_suspend_noirq(PMSG_SUSPEND);
+	suspend_time_phase(SUSPEND_PHASE_DPM_SUSPEND_NOIRQ, start, error);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to power down\n");
 		goto Platform_finish;
@@ -169,14 +176,18 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 	arch_suspend_disable_irqs();
 	BUG_ON(!irqs_disabled());
 
+	start = suspend_time_now();
 	error = syscore_suspend();
+	suspend_time_phase(SUSPEND_PHASE_SYSCORE_SUSPEND, start, error);
 	if (!error) {
 		*wakeup = pm_wakeup_pending();
 		if (!(suspend_test(TEST_CORE) || *wakeup)) {
 			error = suspend_ops->enter(state);
 			events_check_enabled = false;
 		}
+		start = suspend_time_now();
 		syscore_resume();
+		suspend_time_phase(SUSPEND_PHASE_SYSCORE_RESUME, start, 0);
 	}
 
 	arch_suspend_enable_irqs();
@@ -189,7 +200,9 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 	if (suspend_ops->wake)
 		suspend_ops->wake();
 
+	start = suspend_time_now();
 	dpm_resume_noirq(PMSG_RESUME);
+	suspend_time_phase(SUSPEND_PHASE_DPM_RESUME_NOIRQ, start, 0);
 
  Platform_finish:
 	if (suspend_ops->finish)
@@ -206,6 +219,7 @@ static int suspend_enter(suspend_state_t state, bool *wakeup)
 int suspend_devices_and_enter(suspend_state_t state)
 {
 	int error;
+	u64 start;
 	bool wakeup = false;
 
 	if (!suspend_ops)
@@ -219,7 +233,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 	}
 	suspend_console();
 	suspend_test_start();
+	start = suspend_time_now();
 	error = dpm_suspend_start(PMSG_SUSPEND);
+	suspend_time_phase(SUSPEND_PHASE_DPM_SUSPEND, start, error);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
 		goto Recover_platform;
@@ -235,7 +251,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 
  Resume_devices:
 	suspend_test_start();
+	start = suspend_time_now();
 	dpm_resume_end(PMSG_RESUME);
+	suspend_time_phase(SUSPEND_PHASE_DPM_RESUME, start, 0);
 	suspend_test_finish("resume devices");
 	resume_console();
  Close:
@@ -258,7 +276,10 @@ int suspend_devices_and_enter(suspend_state_t state)
  */
 static void suspend_finish(void)
 {
+	u64 start = suspend_time_now();
+
 	suspend_thaw_processes();
+	suspend_time_phase(SUSPEND_PHASE_THAW, start, 0);
 	usermodehelper_enable();
 	pm_notifier_call_chain(PM_POST_SUSPEND);
 	pm_restore_console();
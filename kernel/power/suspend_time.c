@@ -1,5 +1,6 @@
 /*
- * debugfs file to track time spent in suspend
+ * debugfs files to track time spent in suspend, and what it costs to get
+ * there and back
  *
  * Copyright (c) 2011, Google, Inc.
  *
@@ -14,17 +15,279 @@
  * more details.
  */
 
+#include <linux/dcache.h>
 #include <linux/debugfs.h>
+#include <linux/device.h>
 #include <linux/err.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/suspend_time.h>
 #include <linux/syscore_ops.h>
 #include <linux/time.h>
 
 static struct timespec suspend_time_before;
 static unsigned int time_in_suspend_bins[32];
 
+#define PROFILE_NAME_LEN	32
+#define PROFILE_HIST_BINS	16
+#define PROFILE_HASH_BITS	7
+#define PROFILE_MAX_RECORDS	512
+#define PROFILE_TRACE_SIZE	256
+
+/* Phase, device or handler calls faster than this are kept out of the trace */
+static unsigned int trace_threshold_us = 1000;
+module_param(trace_threshold_us, uint, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static const char *phase_names[SUSPEND_PHASE_COUNT] = {
+	[SUSPEND_PHASE_FREEZE]			= "freeze",
+	[SUSPEND_PHASE_DPM_SUSPEND]		= "dpm_suspend",
+	[SUSPEND_PHASE_DPM_SUSPEND_NOIRQ]	= "dpm_suspend_noirq",
+	[SUSPEND_PHASE_SYSCORE_SUSPEND]		= "syscore_suspend",
+	[SUSPEND_PHASE_SYSCORE_RESUME]		= "syscore_resume",
+	[SUSPEND_PHASE_DPM_RESUME_NOIRQ]	= "dpm_resume_noirq",
+	[SUSPEND_PHASE_DPM_RESUME]		= "dpm_resume",
+	[SUSPEND_PHASE_THAW]			= "thaw",
+	[SUSPEND_PHASE_EARLY_SUSPEND]		= "early_suspend",
+	[SUSPEND_PHASE_LATE_RESUME]		= "late_resume",
+	[SUSPEND_PHASE_BACKOFF]			= "backoff",
+};
+
+struct phase_stat {
+	unsigned int count;
+	unsigned int max_us;
+	u64 total_us;
+	unsigned int hist[PROFILE_HIST_BINS];
+};
+
+/* Cost of one device or early suspend handler, keyed by name or by fn */
+struct profile_record {
+	struct hlist_node node;
+	void *fn;
+	char name[PROFILE_NAME_LEN];
+	unsigned int suspend_count;
+	unsigned int max_suspend_us;
+	u64 suspend_us;
+	unsigned int resume_count;
+	unsigned int max_resume_us;
+	u64 resume_us;
+	unsigned int failures;
+	unsigned int backoffs;
+};
+
+struct profile_event {
+	u64 ts;
+	unsigned int cycle;
+	unsigned int dur_us;
+	int error;
+	enum suspend_time_phase phase;
+	char name[PROFILE_NAME_LEN];
+};
+
+static DEFINE_SPINLOCK(profile_lock);
+static struct phase_stat phase_stats[SUSPEND_PHASE_COUNT];
+static struct hlist_head profile_hash[1 << PROFILE_HASH_BITS];
+static unsigned int profile_records;
+static unsigned int profile_records_dropped;
+static struct profile_event profile_trace[PROFILE_TRACE_SIZE];
+static unsigned int profile_trace_count;
+static unsigned int profile_cycle;
+static unsigned int backoffs_unattributed;
+/* What failed during the current cycle, charged if it ends in a backoff */
+static char profile_culprit[PROFILE_NAME_LEN];
+/* Set if no device failed and the culprit is a phase, which has no record */
+static bool profile_culprit_is_phase;
+
+static bool phase_is_resume(enum suspend_time_phase phase)
+{
+	switch (phase) {
+	case SUSPEND_PHASE_SYSCORE_RESUME:
+	case SUSPEND_PHASE_DPM_RESUME_NOIRQ:
+	case SUSPEND_PHASE_DPM_RESUME:
+	case SUSPEND_PHASE_THAW:
+	case SUSPEND_PHASE_LATE_RESUME:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned int profile_elapsed_us(u64 start)
+{
+	s64 delta = suspend_time_now() - start;
+
+	/* local_clock() is only monotonic per cpu */
+	if (delta < 0)
+		return 0;
+	return div_u64(delta, NSEC_PER_USEC);
+}
+
+/* Handlers are looked up by fn and only named when first seen */
+static struct profile_record *profile_find_record_locked(void *fn,
+							 const char *name)
+{
+	struct profile_record *r;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+	unsigned int hash;
+
+	if (fn) {
+		head = &profile_hash[hash_ptr(fn, PROFILE_HASH_BITS)];
+		hlist_for_each_entry(r, pos, head, node)
+			if (r->fn == fn)
+				return r;
+	} else {
+		hash = full_name_hash(name, strlen(name));
+		head = &profile_hash[hash_32(hash, PROFILE_HASH_BITS)];
+		hlist_for_each_entry(r, pos, head, node)
+			if (!r->fn && !strcmp(r->name, name))
+				return r;
+	}
+
+	if (profile_records >= PROFILE_MAX_RECORDS) {
+		profile_records_dropped++;
+		return NULL;
+	}
+	/* Device records are created with interrupts off */
+	r = kzalloc(sizeof(*r), GFP_ATOMIC);
+	if (!r) {
+		profile_records_dropped++;
+		return NULL;
+	}
+	r->fn = fn;
+	if (fn)
+		snprintf(r->name, sizeof(r->name), "%pf", fn);
+	else
+		strlcpy(r->name, name, sizeof(r->name));
+	hlist_add_head(&r->node, head);
+	profile_records++;
+	return r;
+}
+
+static void profile_trace_locked(const char *name,
+				 enum suspend_time_phase phase,
+				 unsigned int us, int error)
+{
+	struct profile_event *e;
+
+	if (us < trace_threshold_us && !error && phase != SUSPEND_PHASE_BACKOFF)
+		return;
+
+	e = &profile_trace[profile_trace_count++ % PROFILE_TRACE_SIZE];
+	e->ts = suspend_time_now();
+	e->cycle = profile_cycle;
+	e->dur_us = us;
+	e->error = error;
+	e->phase = phase;
+	strlcpy(e->name, name, sizeof(e->name));
+}
+
+static void profile_record(void *fn, const char *name,
+			   enum suspend_time_phase phase,
+			   unsigned int us, int error)
+{
+	struct profile_record *r;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	r = profile_find_record_locked(fn, name);
+	if (r)
+		name = r->name;
+	else if (fn)
+		name = "(dropped)";
+	profile_trace_locked(name, phase, us, error);
+	if (r) {
+		if (phase_is_resume(phase)) {
+			r->resume_count++;
+			r->resume_us += us;
+			if (us > r->max_resume_us)
+				r->max_resume_us = us;
+		} else {
+			r->suspend_count++;
+			r->suspend_us += us;
+			if (us > r->max_suspend_us)
+				r->max_suspend_us = us;
+		}
+		if (error)
+			r->failures++;
+	}
+	if (error) {
+		strlcpy(profile_culprit, name, sizeof(profile_culprit));
+		profile_culprit_is_phase = false;
+	}
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+}
+
+void suspend_time_phase(enum suspend_time_phase phase, u64 start, int error)
+{
+	struct phase_stat *stat = &phase_stats[phase];
+	unsigned int us = profile_elapsed_us(start);
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	if (phase == SUSPEND_PHASE_FREEZE) {
+		profile_cycle++;
+		profile_culprit[0] = '\0';
+	}
+	stat->count++;
+	stat->total_us += us;
+	if (us > stat->max_us)
+		stat->max_us = us;
+	stat->hist[min(fls(us / USEC_PER_MSEC), PROFILE_HIST_BINS - 1)]++;
+	profile_trace_locked("-", phase, us, error);
+	/* Keep the device that made the phase fail, if there was one */
+	if (error && !profile_culprit[0]) {
+		strlcpy(profile_culprit, phase_names[phase],
+			sizeof(profile_culprit));
+		profile_culprit_is_phase = true;
+	}
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+}
+
+void suspend_time_device(struct device *dev, enum suspend_time_phase phase,
+			 u64 start, int error)
+{
+	unsigned int us = profile_elapsed_us(start);
+	char name[PROFILE_NAME_LEN];
+
+	/* Most devices have nothing to do for most steps; keep them out */
+	if (!us && !error)
+		return;
+
+	snprintf(name, sizeof(name), "%s %s",
+		 dev_driver_string(dev), dev_name(dev));
+	profile_record(NULL, name, phase, us, error);
+}
+
+/* The caller already timed the handler; us is its duration */
+void suspend_time_handler(void *fn, enum suspend_time_phase phase,
+			  unsigned int us)
+{
+	profile_record(fn, NULL, phase, us, 0);
+}
+
+void suspend_time_backoff(void)
+{
+	struct profile_record *r = NULL;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	phase_stats[SUSPEND_PHASE_BACKOFF].count++;
+	if (profile_culprit[0] && !profile_culprit_is_phase)
+		r = profile_find_record_locked(NULL, profile_culprit);
+	if (r)
+		r->backoffs++;
+	else
+		backoffs_unattributed++;
+	profile_trace_locked(profile_culprit[0] ? profile_culprit : "(none)",
+			     SUSPEND_PHASE_BACKOFF, 0, 0);
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+}
+
 #ifdef CONFIG_DEBUG_FS
 static int suspend_time_debug_show(struct seq_file *s, void *data)
 {
@@ -68,6 +331,139 @@ static int __init suspend_time_debug_init(void)
 }
 
 late_initcall(suspend_time_debug_init);
+
+static int suspend_profile_debug_show(struct seq_file *s, void *data)
+{
+	struct phase_stat *stat;
+	unsigned long irqflags;
+	int phase;
+	int bin;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	seq_printf(s, "phase              count   total_us     max_us\n");
+	for (phase = 0; phase < SUSPEND_PHASE_COUNT; phase++) {
+		stat = &phase_stats[phase];
+		seq_printf(s, "%-17s %6u %10llu %10u\n", phase_names[phase],
+			   stat->count, stat->total_us, stat->max_us);
+	}
+	for (phase = 0; phase < SUSPEND_PHASE_COUNT; phase++) {
+		stat = &phase_stats[phase];
+		/* Backoffs are only counted, they have no duration */
+		if (!stat->count || phase == SUSPEND_PHASE_BACKOFF)
+			continue;
+		seq_printf(s, "\n%s time (ms)  count\n", phase_names[phase]);
+		for (bin = 0; bin < PROFILE_HIST_BINS; bin++) {
+			if (stat->hist[bin] == 0)
+				continue;
+			seq_printf(s, "%5d - %5d %6u\n",
+				   bin ? 1 << (bin - 1) : 0, 1 << bin,
+				   stat->hist[bin]);
+		}
+	}
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+	return 0;
+}
+
+static int suspend_profile_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_profile_debug_show, NULL);
+}
+
+static const struct file_operations suspend_profile_debug_fops = {
+	.open		= suspend_profile_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int suspend_devices_debug_show(struct seq_file *s, void *data)
+{
+	struct profile_record *r;
+	struct hlist_node *pos;
+	unsigned long irqflags;
+	int i;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	seq_printf(s, "records %u dropped %u unattributed_backoffs %u\n",
+		   profile_records, profile_records_dropped,
+		   backoffs_unattributed);
+	seq_printf(s, "suspend_count suspend_us max_suspend_us "
+		   "resume_count resume_us max_resume_us failures backoffs "
+		   "name\n");
+	for (i = 0; i < ARRAY_SIZE(profile_hash); i++) {
+		hlist_for_each_entry(r, pos, &profile_hash[i], node) {
+			seq_printf(s, "%13u %10llu %14u %12u %9llu %13u "
+				   "%8u %8u %s\n",
+				   r->suspend_count, r->suspend_us,
+				   r->max_suspend_us, r->resume_count,
+				   r->resume_us, r->max_resume_us,
+				   r->failures, r->backoffs, r->name);
+		}
+	}
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+	return 0;
+}
+
+static int suspend_devices_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_devices_debug_show, NULL);
+}
+
+static const struct file_operations suspend_devices_debug_fops = {
+	.open		= suspend_devices_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* One event per line, oldest first: cycle ts_ns phase dur_us error name */
+static int suspend_trace_debug_show(struct seq_file *s, void *data)
+{
+	struct profile_event *e;
+	unsigned long irqflags;
+	unsigned int i;
+
+	spin_lock_irqsave(&profile_lock, irqflags);
+	i = profile_trace_count > PROFILE_TRACE_SIZE ?
+		profile_trace_count - PROFILE_TRACE_SIZE : 0;
+	for (; i != profile_trace_count; i++) {
+		e = &profile_trace[i % PROFILE_TRACE_SIZE];
+		seq_printf(s, "%u %llu %s %u %d %s\n", e->cycle, e->ts,
+			   phase_names[e->phase], e->dur_us, e->error,
+			   e->name);
+	}
+	spin_unlock_irqrestore(&profile_lock, irqflags);
+	return 0;
+}
+
+static int suspend_trace_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_trace_debug_show, NULL);
+}
+
+static const struct file_operations suspend_trace_debug_fops = {
+	.open		= suspend_trace_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init suspend_profile_debug_init(void)
+{
+	if (!debugfs_create_file("suspend_profile", 0444, NULL, NULL,
+				 &suspend_profile_debug_fops) ||
+	    !debugfs_create_file("suspend_devices", 0444, NULL, NULL,
+				 &suspend_devices_debug_fops) ||
+	    !debugfs_create_file("suspend_trace", 0444, NULL, NULL,
+				 &suspend_trace_debug_fops)) {
+		pr_err("Failed to create suspend profile debug files\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(suspend_profile_debug_init);
 #endif
 
 static int suspend_time_syscore_suspend(void)
@@ -14,9 +14,12 @@
  */
 
 #include <linux/ctype.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
 #include <linux/module.h>
 #include <linux/wakelock.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 
 #include "power.h"
 
@@ -32,20 +35,67 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_MUTEX(tree_lock);
 
+/*
+ * User wake locks are found through a hash of their names, and kept on a
+ * list in least recently used order. Unused ones are destroyed once they
+ * have been idle for USER_WAKE_LOCK_GC_IDLE, checked every
+ * USER_WAKE_LOCK_GC_INTERVAL unlocks, and the oldest unused one goes
+ * first when max_user_wake_locks is reached.
+ */
+#define USER_WAKE_LOCK_HASH_BITS	7
+#define USER_WAKE_LOCK_GC_INTERVAL	100
+#define USER_WAKE_LOCK_GC_IDLE		(300 * HZ)
+
+static int max_user_wake_locks = 1024;
+module_param_named(max_locks, max_user_wake_locks, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+
 struct user_wake_lock {
-	struct rb_node		node;
+	struct hlist_node	node;
+	struct list_head	lru;
+	unsigned long		last_used;	/* jiffies */
 	struct wake_lock	wake_lock;
 	char			name[0];
 };
-struct rb_root user_wake_locks;
+static struct hlist_head user_wake_locks[1 << USER_WAKE_LOCK_HASH_BITS];
+static LIST_HEAD(user_wake_lock_lru);
+static int user_wake_lock_count;
+static int unlocks_since_gc;
+
+static void user_wake_lock_free(struct user_wake_lock *l)
+{
+	if (debug_mask & DEBUG_NEW)
+		pr_info("user_wake_lock_free: %s\n", l->name);
+	hlist_del(&l->node);
+	list_del(&l->lru);
+	wake_lock_destroy(&l->wake_lock);
+	kfree(l);
+	user_wake_lock_count--;
+}
+
+/*
+ * Destroy unused wake locks idle for longer than idle jiffies, oldest
+ * first, until no more than keep are left.
+ */
+static void user_wake_lock_gc(unsigned long idle, int keep)
+{
+	struct user_wake_lock *l, *n;
+
+	list_for_each_entry_safe(l, n, &user_wake_lock_lru, lru) {
+		if (user_wake_lock_count <= keep ||
+		    time_before(jiffies, l->last_used + idle))
+			break;
+		if (!wake_lock_active(&l->wake_lock))
+			user_wake_lock_free(l);
+	}
+}
 
 static struct user_wake_lock *lookup_wake_lock_name(
 	const char *buf, int allocate, long *timeoutptr)
 {
-	struct rb_node **p = &user_wake_locks.rb_node;
-	struct rb_node *parent = NULL;
+	struct hlist_head *head;
+	struct hlist_node *pos;
 	struct user_wake_lock *l;
-	int diff;
 	u64 timeout;
 	int name_len;
 	const char *arg;
@@ -78,31 +128,32 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	else if (timeoutptr)
 		*timeoutptr = 0;
 
-	/* Lookup wake lock in rbtree */
-	while (*p) {
-		parent = *p;
-		l = rb_entry(parent, struct user_wake_lock, node);
-		diff = strncmp(buf, l->name, name_len);
-		if (!diff && l->name[name_len])
-			diff = -1;
-		if (debug_mask & DEBUG_ERROR)
-			pr_info("lookup_wake_lock_name: compare %.*s %s %d\n",
-				name_len, buf, l->name, diff);
-
-		if (diff < 0)
-			p = &(*p)->rb_left;
-		else if (diff > 0)
-			p = &(*p)->rb_right;
-		else
-			return l;
+	/* Lookup wake lock in the hash */
+	head = &user_wake_locks[hash_32(full_name_hash(buf, name_len),
+					USER_WAKE_LOCK_HASH_BITS)];
+	hlist_for_each_entry(l, pos, head, node) {
+		if (debug_mask & DEBUG_LOOKUP)
+			pr_info("lookup_wake_lock_name: compare %.*s %s\n",
+				name_len, buf, l->name);
+		if (!strncmp(buf, l->name, name_len) && !l->name[name_len])
+			goto found;
 	}
 
-	/* Allocate and add new wakelock to rbtree */
+	/* Allocate and add new wakelock to the hash */
 	if (!allocate) {
 		if (debug_mask & DEBUG_ERROR)
 			pr_info("lookup_wake_lock_name: %.*s not found\n",
 				name_len, buf);
-		return ERR_PTR(-EINVAL);
+		return NULL;
+	}
+	if (user_wake_lock_count >= max_user_wake_locks)
+		user_wake_lock_gc(0, max_user_wake_locks - 1);
+	if (user_wake_lock_count >= max_user_wake_locks) {
+		if (debug_mask & DEBUG_FAILURE)
+			pr_err("lookup_wake_lock_name: %d wake locks in use, "
+				"no room for %.*s\n", user_wake_lock_count,
+				name_len, buf);
+		return ERR_PTR(-ENOSPC);
 	}
 	l = kzalloc(sizeof(*l) + name_len + 1, GFP_KERNEL);
 	if (l == NULL) {
@@ -115,8 +166,12 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	if (debug_mask & DEBUG_NEW)
 		pr_info("lookup_wake_lock_name: new wake lock %s\n", l->name);
 	wake_lock_init(&l->wake_lock, WAKE_LOCK_SUSPEND, l->name);
-	rb_link_node(&l->node, parent, p);
-	rb_insert_color(&l->node, &user_wake_locks);
+	hlist_add_head(&l->node, head);
+	list_add_tail(&l->lru, &user_wake_lock_lru);
+	user_wake_lock_count++;
+found:
+	l->last_used = jiffies;
+	list_move_tail(&l->lru, &user_wake_lock_lru);
 	return l;
 
 bad_arg:
@@ -126,94 +181,175 @@ bad_arg:
 	return ERR_PTR(-EINVAL);
 }
 
-ssize_t wake_lock_show(
-	struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+/* Caller must hold tree_lock */
+static int do_wake_lock(const char *buf)
+{
+	long timeout;
+	struct user_wake_lock *l;
+
+	l = lookup_wake_lock_name(buf, 1, &timeout);
+	if (IS_ERR(l))
+		return PTR_ERR(l);
+
+	if (debug_mask & DEBUG_ACCESS)
+		pr_info("wake_lock_store: %s, timeout %ld\n", l->name, timeout);
+
+	if (timeout)
+		wake_lock_timeout(&l->wake_lock, timeout);
+	else
+		wake_lock(&l->wake_lock);
+	return 0;
+}
+
+/* Caller must hold tree_lock */
+static int do_wake_unlock(const char *buf)
+{
+	struct user_wake_lock *l;
+
+	l = lookup_wake_lock_name(buf, 0, NULL);
+	if (IS_ERR(l))
+		return PTR_ERR(l);
+	/* never locked, or collected since: already unlocked */
+	if (!l)
+		return 0;
+
+	if (debug_mask & DEBUG_ACCESS)
+		pr_info("wake_unlock_store: %s\n", l->name);
+
+	wake_unlock(&l->wake_lock);
+	if (++unlocks_since_gc >= USER_WAKE_LOCK_GC_INTERVAL) {
+		unlocks_since_gc = 0;
+		user_wake_lock_gc(USER_WAKE_LOCK_GC_IDLE, 0);
+	}
+	return 0;
+}
+
+static int user_wake_lock_cmp(const void *a, const void *b)
+{
+	const struct user_wake_lock *la = *(const struct user_wake_lock **)a;
+	const struct user_wake_lock *lb = *(const struct user_wake_lock **)b;
+
+	return strcmp(la->name, lb->name);
+}
+
+/* List active or inactive locks, sorted by name. */
+static ssize_t user_wake_lock_show(char *buf, bool active)
 {
 	char *s = buf;
 	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
+	struct user_wake_lock **locks;
 	struct user_wake_lock *l;
+	int i, n = 0;
 
 	mutex_lock(&tree_lock);
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
-		if (wake_lock_active(&l->wake_lock))
-			s += scnprintf(s, end - s, "%s ", l->name);
+	locks = kmalloc(user_wake_lock_count * sizeof(*locks), GFP_KERNEL);
+	if (!locks && user_wake_lock_count) {
+		mutex_unlock(&tree_lock);
+		return -ENOMEM;
+	}
+	list_for_each_entry(l, &user_wake_lock_lru, lru) {
+		if (!!wake_lock_active(&l->wake_lock) == active)
+			locks[n++] = l;
 	}
+	sort(locks, n, sizeof(*locks), user_wake_lock_cmp, NULL);
+	for (i = 0; i < n; i++)
+		s += scnprintf(s, end - s, "%s ", locks[i]->name);
 	s += scnprintf(s, end - s, "\n");
 
 	mutex_unlock(&tree_lock);
+	kfree(locks);
 	return (s - buf);
 }
 
+ssize_t wake_lock_show(
+	struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	return user_wake_lock_show(buf, true);
+}
+
 ssize_t wake_lock_store(
 	struct kobject *kobj, struct kobj_attribute *attr,
 	const char *buf, size_t n)
 {
-	long timeout;
-	struct user_wake_lock *l;
+	int ret;
 
 	mutex_lock(&tree_lock);
-	l = lookup_wake_lock_name(buf, 1, &timeout);
-	if (IS_ERR(l)) {
-		n = PTR_ERR(l);
-		goto bad_name;
-	}
-
-	if (debug_mask & DEBUG_ACCESS)
-		pr_info("wake_lock_store: %s, timeout %ld\n", l->name, timeout);
-
-	if (timeout)
-		wake_lock_timeout(&l->wake_lock, timeout);
-	else
-		wake_lock(&l->wake_lock);
-bad_name:
+	ret = do_wake_lock(buf);
 	mutex_unlock(&tree_lock);
-	return n;
+	return ret ? ret : n;
 }
 
 
 ssize_t wake_unlock_show(
 	struct kobject *kobj, struct kobj_attribute *attr, char *buf)
 {
-	char *s = buf;
-	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
-	struct user_wake_lock *l;
+	return user_wake_lock_show(buf, false);
+}
+
+ssize_t wake_unlock_store(
+	struct kobject *kobj, struct kobj_attribute *attr,
+	const char *buf, size_t n)
+{
+	int ret;
 
 	mutex_lock(&tree_lock);
+	ret = do_wake_unlock(buf);
+	mutex_unlock(&tree_lock);
+	return ret ? ret : n;
+}
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
-		if (!wake_lock_active(&l->wake_lock))
-			s += scnprintf(s, end - s, "%s ", l->name);
-	}
-	s += scnprintf(s, end - s, "\n");
+ssize_t wake_lock_batch_show(
+	struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	int count;
 
+	mutex_lock(&tree_lock);
+	count = user_wake_lock_count;
 	mutex_unlock(&tree_lock);
-	return (s - buf);
+	return sprintf(buf, "%d %d\n", count, max_user_wake_locks);
 }
 
-ssize_t wake_unlock_store(
+/*
+ * Lock and unlock several wake locks in one write, one per line:
+ * "+name [timeout]" to lock and "-name" to unlock. All lines are
+ * processed, the first error is returned.
+ */
+ssize_t wake_lock_batch_store(
 	struct kobject *kobj, struct kobj_attribute *attr,
 	const char *buf, size_t n)
 {
-	struct user_wake_lock *l;
+	char *cmds, *line, *next;
+	int ret = 0;
+	int err;
+
+	cmds = kstrndup(buf, n, GFP_KERNEL);
+	if (!cmds)
+		return -ENOMEM;
 
 	mutex_lock(&tree_lock);
-	l = lookup_wake_lock_name(buf, 0, NULL);
-	if (IS_ERR(l)) {
-		n = PTR_ERR(l);
-		goto not_found;
+	next = cmds;
+	while ((line = strsep(&next, "\n")) != NULL) {
+		switch (*line) {
+		case '\0':
+			continue;
+		case '+':
+			err = do_wake_lock(line + 1);
+			break;
+		case '-':
+			err = do_wake_unlock(line + 1);
+			break;
+		default:
+			if (debug_mask & DEBUG_ERROR)
+				pr_info("wake_lock_batch_store: bad command "
+					"%s\n", line);
+			err = -EINVAL;
+		}
+		if (err && !ret)
+			ret = err;
 	}
-
-	if (debug_mask & DEBUG_ACCESS)
-		pr_info("wake_unlock_store: %s\n", l->name);
-
-	wake_unlock(&l->wake_lock);
-not_found:
 	mutex_unlock(&tree_lock);
-	return n;
-}
 
+	kfree(cmds);
+	return ret ? ret : n;
+}
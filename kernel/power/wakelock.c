@@ -17,6 +17,7 @@
 #include <linux/platform_device.h>
 #include <linux/rtc.h>
 #include <linux/suspend.h>
+#include <linux/suspend_time.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #ifdef CONFIG_WAKELOCK_STAT
@@ -40,10 +41,23 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
+/*
+ * list_lock protects the list of wake locks and the expiry trees. Each
+ * wake lock's state_lock protects its flags and stats, and nests inside
+ * list_lock.
+ *
+ * Locking or unlocking a wake lock without a timeout, while the main wake
+ * lock is held, only takes its own state_lock and updates active_count.
+ * Everything else (timeouts, the main wake lock, the sleep time stats
+ * kept while the main wake lock is released) also takes list_lock.
+ */
 static DEFINE_SPINLOCK(list_lock);
-static LIST_HEAD(inactive_locks);
-static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
-static int current_event_num;
+static LIST_HEAD(wake_locks);
+/* Number of active wake locks without a timeout, per type */
+static atomic_t active_count[WAKE_LOCK_TYPE_COUNT];
+/* Active wake locks with a timeout, per type, ordered by expires */
+static struct rb_root expire_tree[WAKE_LOCK_TYPE_COUNT];
+static atomic_t current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
 suspend_state_t requested_suspend_state = PM_SUSPEND_MEM;
@@ -131,16 +145,22 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 
 	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
 			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
-	list_for_each_entry(lock, &inactive_locks, link)
-		ret = print_lock_stat(m, lock);
-	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link)
-			ret = print_lock_stat(m, lock);
+	/* Inactive locks first, then the active ones of each type */
+	for (type = -1; type < WAKE_LOCK_TYPE_COUNT; type++) {
+		list_for_each_entry(lock, &wake_locks, link) {
+			spin_lock(&lock->state_lock);
+			if (type < 0 ? !(lock->flags & WAKE_LOCK_ACTIVE) :
+			    (lock->flags & WAKE_LOCK_ACTIVE) &&
+			    (lock->flags & WAKE_LOCK_TYPE_MASK) == type)
+				ret = print_lock_stat(m, lock);
+			spin_unlock(&lock->state_lock);
+		}
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return 0;
 }
 
+/* Caller must hold lock->state_lock */
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -175,7 +195,18 @@ static void update_sleep_wait_stats_locked(int done)
 
 	now = ktime_get();
 	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != WAKE_LOCK_SUSPEND)
+			continue;
+		/*
+		 * Taking every state_lock, active or not, also waits for
+		 * wake_lock() calls that saw the main wake lock held.
+		 */
+		spin_lock(&lock->state_lock);
+		if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+			spin_unlock(&lock->state_lock);
+			continue;
+		}
 		expired = get_expired_time(lock, &etime);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
 			if (expired)
@@ -189,20 +220,41 @@ static void update_sleep_wait_stats_locked(int done)
 			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
 		else
 			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+		spin_unlock(&lock->state_lock);
 	}
 	last_sleep_time_update = now;
 }
 #endif
 
 
-static void expire_wake_lock(struct wake_lock *lock)
+static void expire_tree_insert(struct wake_lock *lock, int type)
 {
+	struct rb_node **p = &expire_tree[type].rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct wake_lock, expire_node);
+		if (time_before(lock->expires, entry->expires))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &expire_tree[type]);
+}
+
+/* Caller must acquire the list_lock spinlock */
+static void expire_wake_lock(struct wake_lock *lock, int type)
+{
+	spin_lock(&lock->state_lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	rb_erase(&lock->expire_node, &expire_tree[type]);
+	spin_unlock(&lock->state_lock);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
 }
@@ -211,42 +263,53 @@ static void expire_wake_lock(struct wake_lock *lock)
 static void print_active_locks(int type)
 {
 	struct wake_lock *lock;
+	struct rb_node *node;
 	bool print_expired = true;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout > 0)
-				pr_info("active wake lock %s, time left %ld\n",
-					lock->name, timeout);
-			else if (print_expired)
-				pr_info("wake lock %s, expired\n", lock->name);
-		} else {
-			pr_info("active wake lock %s\n", lock->name);
-			if (!(debug_mask & DEBUG_EXPIRE))
-				print_expired = false;
-		}
+	list_for_each_entry(lock, &wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    (lock->flags & (WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE)) !=
+		    WAKE_LOCK_ACTIVE)
+			continue;
+		pr_info("active wake lock %s\n", lock->name);
+		if (!(debug_mask & DEBUG_EXPIRE))
+			print_expired = false;
+	}
+	for (node = rb_first(&expire_tree[type]); node; node = rb_next(node)) {
+		long timeout;
+
+		lock = rb_entry(node, struct wake_lock, expire_node);
+		timeout = lock->expires - jiffies;
+		if (timeout > 0)
+			pr_info("active wake lock %s, time left %ld\n",
+				lock->name, timeout);
+		else if (print_expired)
+			pr_info("wake lock %s, expired\n", lock->name);
 	}
 }
 
+/* Caller must acquire the list_lock spinlock */
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock *lock;
+	struct rb_node *node;
+	unsigned long now = jiffies;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (atomic_read(&active_count[type]))
+		return -1;
+	while ((node = rb_first(&expire_tree[type]))) {
+		lock = rb_entry(node, struct wake_lock, expire_node);
+		if ((long)(lock->expires - now) > 0)
+			break;
+		expire_wake_lock(lock, type);
 	}
-	return max_timeout;
+	node = rb_last(&expire_tree[type]);
+	if (!node)
+		return 0;
+	lock = rb_entry(node, struct wake_lock, expire_node);
+	return lock->expires - now;
 }
 
 long has_wake_lock(int type)
@@ -264,6 +327,7 @@ long has_wake_lock(int type)
 static void suspend_backoff(void)
 {
 	pr_info("suspend: too many immediate wakeups, back off\n");
+	suspend_time_backoff();
 	wake_lock_timeout(&suspend_backoff_lock,
 			  msecs_to_jiffies(SUSPEND_BACKOFF_INTERVAL));
 }
@@ -280,7 +344,7 @@ static void suspend(struct work_struct *work)
 		return;
 	}
 
-	entry_event_num = current_event_num;
+	entry_event_num = atomic_read(&current_event_num);
 	sys_sync();
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("suspend: enter suspend\n");
@@ -308,7 +372,7 @@ static void suspend(struct work_struct *work)
 		suspend_short_count = 0;
 	}
 
-	if (current_event_num == entry_event_num) {
+	if (atomic_read(&current_event_num) == entry_event_num) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: pm_suspend returned with no event\n");
 		wake_lock_timeout(&unknown_wakeup, HZ / 2);
@@ -334,6 +398,28 @@ static void expire_wake_locks(unsigned long data)
 }
 static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 
+/*
+ * Arm the expire timer for the wake locks that time out, or start suspend
+ * if none is left. Caller must acquire the list_lock spinlock.
+ */
+static void update_expire_timer_locked(struct wake_lock *lock,
+				       const char *caller, long has_lock)
+{
+	if (has_lock > 0) {
+		if (debug_mask & DEBUG_EXPIRE)
+			pr_info("%s: %s, start expire timer, %ld\n",
+				caller, lock->name, has_lock);
+		mod_timer(&expire_timer, jiffies + has_lock);
+	} else {
+		if (del_timer(&expire_timer))
+			if (debug_mask & DEBUG_EXPIRE)
+				pr_info("%s: %s, stop expire timer\n",
+					caller, lock->name);
+		if (has_lock == 0)
+			queue_work(suspend_work_queue, &suspend_work);
+	}
+}
+
 static int power_suspend_late(struct device *dev)
 {
 	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
@@ -379,8 +465,10 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
 
 	INIT_LIST_HEAD(&lock->link);
+	RB_CLEAR_NODE(&lock->expire_node);
+	spin_lock_init(&lock->state_lock);
 	spin_lock_irqsave(&list_lock, irqflags);
-	list_add(&lock->link, &inactive_locks);
+	list_add(&lock->link, &wake_locks);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_init);
@@ -391,7 +479,15 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
-	lock->flags &= ~WAKE_LOCK_INITIALIZED;
+	spin_lock(&lock->state_lock);
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->expire_node,
+			 &expire_tree[lock->flags & WAKE_LOCK_TYPE_MASK]);
+	else if (lock->flags & WAKE_LOCK_ACTIVE)
+		atomic_dec(&active_count[lock->flags & WAKE_LOCK_TYPE_MASK]);
+	lock->flags &= ~(WAKE_LOCK_INITIALIZED | WAKE_LOCK_ACTIVE |
+			 WAKE_LOCK_AUTO_EXPIRE);
+	spin_unlock(&lock->state_lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
@@ -412,6 +508,47 @@ void wake_lock_destroy(struct wake_lock *lock)
 }
 EXPORT_SYMBOL(wake_lock_destroy);
 
+/*
+ * Lock without a timeout, taking only the wake lock's own state_lock.
+ * Returns false if the caller must take the slow path.
+ */
+static bool wake_lock_fast(struct wake_lock *lock, int type)
+{
+	unsigned long irqflags;
+	bool done = false;
+
+	if (lock == &main_wake_lock)
+		return false;
+	spin_lock_irqsave(&lock->state_lock, irqflags);
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		goto out;
+	/*
+	 * The sleep time stats and wakeup tracking only change while the
+	 * main wake lock is released. Seeing it held under our state_lock
+	 * is enough: wake_unlock(&main_wake_lock) updates the sleep stats
+	 * under every state_lock before it looks at active_count, and a
+	 * suspend racing with us is aborted by has_wake_lock().
+	 */
+	if (type == WAKE_LOCK_SUSPEND && !wake_lock_active(&main_wake_lock))
+		goto out;
+	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+		lock->flags |= WAKE_LOCK_ACTIVE;
+#ifdef CONFIG_WAKELOCK_STAT
+		lock->stat.last_time = ktime_get();
+#endif
+		atomic_inc(&active_count[type]);
+	}
+	lock->expires = LONG_MAX;
+	if (type == WAKE_LOCK_SUSPEND)
+		atomic_inc(&current_event_num);
+	if (debug_mask & DEBUG_WAKE_LOCK)
+		pr_info("wake_lock: %s, type %d\n", lock->name, type);
+	done = true;
+out:
+	spin_unlock_irqrestore(&lock->state_lock, irqflags);
+	return done;
+}
+
 static void wake_lock_internal(
 	struct wake_lock *lock, long timeout, int has_timeout)
 {
@@ -419,10 +556,14 @@ static void wake_lock_internal(
 	unsigned long irqflags;
 	long expire_in;
 
-	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
 	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
+	if (!has_timeout && wake_lock_fast(lock, type))
+		return;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->state_lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup) {
 		if (debug_mask & DEBUG_WAKEUP)
@@ -441,8 +582,11 @@ static void wake_lock_internal(
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
+	} else if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
+		rb_erase(&lock->expire_node, &expire_tree[type]);
+	} else {
+		atomic_dec(&active_count[type]);
 	}
-	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -450,16 +594,17 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		expire_tree_insert(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
+		atomic_inc(&active_count[type]);
 	}
+	spin_unlock(&lock->state_lock);
 	if (type == WAKE_LOCK_SUSPEND) {
-		current_event_num++;
+		atomic_inc(&current_event_num);
 #ifdef CONFIG_WAKELOCK_STAT
 		if (lock == &main_wake_lock)
 			update_sleep_wait_stats_locked(1);
@@ -470,19 +615,7 @@ static void wake_lock_internal(
 			expire_in = has_wake_lock_locked(type);
 		else
 			expire_in = -1;
-		if (expire_in > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_lock: %s, start expire timer, "
-					"%ld\n", lock->name, expire_in);
-			mod_timer(&expire_timer, jiffies + expire_in);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_lock: %s, stop expire timer\n",
-						lock->name);
-			if (expire_in == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		update_expire_timer_locked(lock, "wake_lock", expire_in);
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -499,35 +632,71 @@ void wake_lock_timeout(struct wake_lock *lock, long timeout)
 }
 EXPORT_SYMBOL(wake_lock_timeout);
 
+/*
+ * Unlock a wake lock without a timeout, taking only its own state_lock.
+ * Returns false if the caller must take the slow path.
+ */
+static bool wake_unlock_fast(struct wake_lock *lock, int type)
+{
+	unsigned long irqflags;
+	int count = -1;
+
+	if (lock == &main_wake_lock)
+		return false;
+	spin_lock_irqsave(&lock->state_lock, irqflags);
+	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) ||
+	    (type == WAKE_LOCK_SUSPEND && !wake_lock_active(&main_wake_lock))) {
+		spin_unlock_irqrestore(&lock->state_lock, irqflags);
+		return false;
+	}
+#ifdef CONFIG_WAKELOCK_STAT
+	wake_unlock_stat_locked(lock, 0);
+#endif
+	if (debug_mask & DEBUG_WAKE_LOCK)
+		pr_info("wake_unlock: %s\n", lock->name);
+	if (lock->flags & WAKE_LOCK_ACTIVE) {
+		lock->flags &= ~WAKE_LOCK_ACTIVE;
+		count = atomic_dec_return(&active_count[type]);
+	}
+	spin_unlock_irqrestore(&lock->state_lock, irqflags);
+
+	/* Raced with the main wake lock going away, we were the last one */
+	if (type == WAKE_LOCK_SUSPEND && count == 0) {
+		spin_lock_irqsave(&list_lock, irqflags);
+		update_expire_timer_locked(lock, "wake_unlock",
+					   has_wake_lock_locked(type));
+		spin_unlock_irqrestore(&list_lock, irqflags);
+	}
+	return true;
+}
+
 void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
-	spin_lock_irqsave(&list_lock, irqflags);
+
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
+	if (wake_unlock_fast(lock, type))
+		return;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->state_lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 0);
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->expire_node, &expire_tree[type]);
+	else if (lock->flags & WAKE_LOCK_ACTIVE)
+		atomic_dec(&active_count[type]);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	spin_unlock(&lock->state_lock);
 	if (type == WAKE_LOCK_SUSPEND) {
-		long has_lock = has_wake_lock_locked(type);
-		if (has_lock > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_unlock: %s, start expire timer, "
-					"%ld\n", lock->name, has_lock);
-			mod_timer(&expire_timer, jiffies + has_lock);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_unlock: %s, stop expire "
-						"timer\n", lock->name);
-			if (has_lock == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		/*
+		 * Update the sleep stats first: it also waits for the wake
+		 * locks taken while the main wake lock was still held.
+		 */
 		if (lock == &main_wake_lock) {
 			if (debug_mask & DEBUG_SUSPEND)
 				print_active_locks(WAKE_LOCK_SUSPEND);
@@ -535,6 +704,8 @@ void wake_unlock(struct wake_lock *lock)
 			update_sleep_wait_stats_locked(0);
 #endif
 		}
+		update_expire_timer_locked(lock, "wake_unlock",
+					   has_wake_lock_locked(type));
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -564,8 +735,8 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
-		INIT_LIST_HEAD(&active_wake_locks[i]);
+	for (i = 0; i < ARRAY_SIZE(expire_tree); i++)
+		expire_tree[i] = RB_ROOT;
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
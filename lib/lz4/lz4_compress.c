@@ -0,0 +1,124 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  Changed for kernel use, single pass with a 4K-entry hash table of
+ *  positions, suitable for inputs of a few pages.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static inline unsigned char *lz4_put_literals(unsigned char *op,
+		unsigned char *token, const unsigned char *anchor, size_t len)
+{
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		*token = len << ML_BITS;
+	}
+	memcpy(op, anchor, len);
+	return op + len;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *table = wrkmem;
+	const unsigned char *ip = src, *anchor = src, *ref, *start;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst, *token;
+	unsigned int misses = 1 << SKIP_STRENGTH;
+	size_t len;
+	u32 seq, h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	/*
+	 * Unset entries point at the start of src; candidates are
+	 * always checked byte for byte, so that is harmless.
+	 */
+	memset(table, 0, LZ4_MEM_COMPRESS);
+
+	while (ip < mflimit) {
+		seq = get_unaligned((const u32 *)ip);
+		h = lz4_hash(seq);
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ip - ref > MAX_DISTANCE || ref == ip ||
+		    get_unaligned((const u32 *)ref) != seq) {
+			ip += misses++ >> SKIP_STRENGTH;
+			continue;
+		}
+		misses = 1 << SKIP_STRENGTH;
+
+		/* Catch up with the bytes before the match */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		token = op++;
+		op = lz4_put_literals(op, token, anchor, ip - anchor);
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		ip += MINMATCH;
+		ref += MINMATCH;
+		start = ip;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - start;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+		anchor = ip;
+
+		if (ip >= mflimit)
+			break;
+		table[lz4_hash(get_unaligned((const u32 *)(ip - 2)))] =
+			ip - 2 - src;
+	}
+
+last_literals:
+	token = op++;
+	op = lz4_put_literals(op, token, anchor, iend - anchor);
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,23 @@
+/*
+ *  lz4defs.h -- architecture specific defines
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ */
+
+/* Every sequence: token, literals, 16-bit offset, match */
+#define MINMATCH	4
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* The last match must start at least MFLIMIT bytes before the end */
+#define MFLIMIT		12
+/* and the last LASTLITERALS bytes are always literals */
+#define LASTLITERALS	5
+
+#define MAX_DISTANCE	65535
+
+/* Search step grows by one every 2^SKIP_STRENGTH misses */
+#define SKIP_STRENGTH	6
@@ -27,6 +27,11 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/workqueue.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,43 +42,77 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned_root;	/* unpinned ranges, by pgstart */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct mutex mutex;		/* protects all of the above */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex', `lru' and `purge' also by
+ * `ashmem_lru_lock'
+ *
+ * The ranges of an area never overlap, so ordering them by pgstart also
+ * orders them by pgend and the tree can be searched by either end.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct list_head purge;		/* entry in purge list, if pending */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * Ranges purged by the shrinker but not yet truncated, protected by
+ * ashmem_lru_lock.  Ranges larger than ASHMEM_PURGE_BATCH pages are
+ * truncated from ashmem_purge_work instead of from reclaim.
+ */
+static LIST_HEAD(ashmem_purge_list);
+
+#define ASHMEM_PURGE_BATCH	256
+
+/*
+ * ashmem_lru_lock - protects the LRU list, lru_count, the purge list and
+ * ashmem_stats
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
+ *
+ * Reclaim never sleeps on asma->mutex: the shrinker and the purge work
+ * only trylock it and skip areas that are busy in an ioctl.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* purge statistics, protected by ashmem_lru_lock */
+static struct ashmem_stats {
+	unsigned long scans;		/* shrinker calls that purged */
+	unsigned long pages_purged;	/* pages purged by the shrinker */
+	unsigned long ranges_deferred;	/* ranges handed to the work */
+	unsigned long areas_skipped;	/* ranges skipped, area was busy */
+	u64 scan_ns;			/* total time spent in the shrinker */
+	u64 scan_ns_max;		/* longest shrinker call */
+	u64 work_ns;			/* total time spent in the work */
+} ashmem_stats;
+
+static void ashmem_purge_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ashmem_purge_work, ashmem_purge_work_fn);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -90,43 +129,86 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
   (((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
- (((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
-
-#define page_range_in_range(range, start, end) \
-  (page_in_range(range, start) || page_in_range(range, end) || \
-   page_range_subsumes_range(range, start, end))
-
-#define range_before_page(range, page) \
-  ((range)->pgend < (page))
-
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
 }
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+/*
+ * range_first - returns the first unpinned range that ends at or after
+ * page 'pgstart', or NULL if there is none.
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *n = asma->unpinned_root.rb_node;
+	struct ashmem_range *first = NULL;
+
+	while (n) {
+		struct ashmem_range *range;
+
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range->pgend >= pgstart) {
+			first = range;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	return first;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
+}
+
+static void range_insert(struct ashmem_area *asma, struct ashmem_range *range)
+{
+	struct rb_node **p = &asma->unpinned_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct ashmem_range *entry;
+
+		parent = *p;
+		entry = rb_entry(parent, struct ashmem_range, node);
+		if (range->pgstart < entry->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_root);
+}
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
 	struct ashmem_range *range;
@@ -139,38 +221,81 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgstart = start;
 	range->pgend = end;
 	range->purged = purged;
+	INIT_LIST_HEAD(&range->purge);
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_insert(asma, range);
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_add(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 
 	return 0;
 }
 
+/* Caller must hold asma->mutex. */
+static void range_truncate(struct ashmem_range *range)
+{
+	struct inode *inode = range->asma->file->f_dentry->d_inode;
+	loff_t start = range->pgstart * PAGE_SIZE;
+	loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+	vmtruncate_range(inode, start, end);
+}
+
+/*
+ * range_purge_pending - truncate a range whose purge was deferred, before
+ * it is pinned, resized or freed.  The purge entry only changes with
+ * asma->mutex held, so it can be tested without ashmem_lru_lock.
+ *
+ * Caller must hold asma->mutex.
+ */
+static void range_purge_pending(struct ashmem_range *range)
+{
+	if (list_empty(&range->purge))
+		return;
+
+	spin_lock(&ashmem_lru_lock);
+	list_del_init(&range->purge);
+	spin_unlock(&ashmem_lru_lock);
+
+	range_truncate(range);
+}
+
+/* Caller must hold asma->mutex. */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
-	if (range_on_lru(range))
+	range_purge_pending(range);
+	rb_erase(&range->node, &range->asma->unpinned_root);
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Shrinking never moves a range past its neighbours, so the tree stays
+ * ordered.  Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
+	range_purge_pending(range);
+
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
 
 	if (range_on_lru(range))
 		lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,7 +311,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned_root = RB_ROOT;
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -197,12 +323,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((n = rb_first(&asma->unpinned_root)))
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +343,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +364,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +373,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +394,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +411,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,7 +454,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -345,35 +471,115 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed.  Ranges of areas that are busy in an ioctl are skipped and
+ * count against 'nr_to_scan', so a scan never waits on userspace and is
+ * bounded by the amount of work it was asked to do.  Large ranges are
+ * truncated from a work item so that reclaim does not stall on them.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	unsigned long purged = 0, skipped = 0, deferred = 0;
+	long nr_to_scan = sc->nr_to_scan;
+	u64 start_ns, ns;
+	int ret;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+	if (nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
+	if (!nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	start_ns = sched_clock();
+	spin_lock(&ashmem_lru_lock);
+	while (nr_to_scan > 0 && !list_empty(&ashmem_lru_list)) {
+		struct ashmem_area *asma;
+
+		range = list_first_entry(&ashmem_lru_list,
+					 struct ashmem_range, lru);
+		asma = range->asma;
+
+		if (!mutex_trylock(&asma->mutex)) {
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			nr_to_scan -= range_size(range);
+			skipped++;
+			continue;
+		}
 
-		vmtruncate_range(inode, start, end);
 		range->purged = ASHMEM_WAS_PURGED;
 		lru_del(range);
+		nr_to_scan -= range_size(range);
+		purged += range_size(range);
+
+		if (range_size(range) > ASHMEM_PURGE_BATCH) {
+			list_add_tail(&range->purge, &ashmem_purge_list);
+			mutex_unlock(&asma->mutex);
+			deferred++;
+			continue;
+		}
+
+		spin_unlock(&ashmem_lru_lock);
+		range_truncate(range);
+		mutex_unlock(&asma->mutex);
+		spin_lock(&ashmem_lru_lock);
+	}
+	ns = sched_clock() - start_ns;
+	if (purged)
+		ashmem_stats.scans++;
+	ashmem_stats.pages_purged += purged;
+	ashmem_stats.areas_skipped += skipped;
+	ashmem_stats.ranges_deferred += deferred;
+	ashmem_stats.scan_ns += ns;
+	if (ns > ashmem_stats.scan_ns_max)
+		ashmem_stats.scan_ns_max = ns;
+	ret = lru_count;
+	spin_unlock(&ashmem_lru_lock);
+
+	if (deferred)
+		schedule_delayed_work(&ashmem_purge_work, 0);
+
+	return ret;
+}
+
+/*
+ * ashmem_purge_work_fn - truncate the ranges the shrinker deferred.  Busy
+ * areas are retried later; their ioctl may also truncate the range first
+ * through range_purge_pending().
+ */
+static void ashmem_purge_work_fn(struct work_struct *work)
+{
+	struct ashmem_range *range;
+	LIST_HEAD(busy);
+	u64 start_ns = sched_clock();
+	int retry;
+
+	spin_lock(&ashmem_lru_lock);
+	while (!list_empty(&ashmem_purge_list)) {
+		struct ashmem_area *asma;
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		range = list_first_entry(&ashmem_purge_list,
+					 struct ashmem_range, purge);
+		asma = range->asma;
+
+		if (!mutex_trylock(&asma->mutex)) {
+			list_move_tail(&range->purge, &busy);
+			continue;
+		}
+
+		list_del_init(&range->purge);
+		spin_unlock(&ashmem_lru_lock);
+		range_truncate(range);
+		mutex_unlock(&asma->mutex);
+		cond_resched();
+		spin_lock(&ashmem_lru_lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+	retry = !list_empty(&busy);
+	list_splice(&busy, &ashmem_purge_list);
+	ashmem_stats.work_ns += sched_clock() - start_ns;
+	spin_unlock(&ashmem_lru_lock);
 
-	return lru_count;
+	if (retry)
+		schedule_delayed_work(&ashmem_purge_work, 1);
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -385,7 +591,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +606,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +614,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +628,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +637,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +654,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -457,17 +663,17 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
+		ret |= range->purged;
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -484,37 +690,33 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
-
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
 
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+			continue;
+		}
 
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
+		/* Case #2: We overlap from the start, so adjust it */
+		if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+			continue;
+		}
 
-			/*
-			 * Case #4: We eat a chunk out of the middle. A bit
-			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
-			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
-			range_shrink(range, range->pgstart, pgstart - 1);
-			break;
+		/* Case #3: We overlap from the rear, so adjust it */
+		if (range->pgend <= pgend) {
+			range_shrink(range, range->pgstart, pgstart-1);
+			continue;
 		}
+
+		/*
+		 * Case #4: We eat a chunk out of the middle. A bit
+		 * more complicated, we allocate a new range for the
+		 * second half and adjust the first chunk's endpoint.
+		 */
+		range_alloc(asma, range->purged, pgend + 1, range->pgend);
+		range_shrink(range, range->pgstart, pgstart - 1);
+		break;
 	}
 
 	return ret;
@@ -523,59 +725,76 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
-
-		/*
-		 * The user can ask us to unpin pages that are already entirely
-		 * or partially pinned. We handle those two cases here.
-		 */
-		if (page_range_subsumed_by_range(range, pgstart, pgend))
-			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+	range = range_first(asma, pgstart);
+
+	/*
+	 * The user can ask us to unpin pages that are already entirely
+	 * or partially unpinned. We handle those two cases here, merging
+	 * every range we overlap into the new one.
+	 */
+	if (range && page_range_subsumed_by_range(range, pgstart, pgend))
+		return 0;
+	for (; range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	return ret;
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
+
+	return ASHMEM_IS_PINNED;
+}
+
+/*
+ * pin_to_pages - validates 'pin' and converts it to an inclusive range of
+ * pages.  Returns zero on success.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int pin_to_pages(struct ashmem_area *asma, struct ashmem_pin *pin,
+			size_t *pgstart, size_t *pgend)
+{
+	/* per custom, you can pass zero for len to mean "everything onward" */
+	if (!pin->len)
+		pin->len = PAGE_ALIGN(asma->size) - pin->offset;
+
+	if (unlikely((pin->offset | pin->len) & ~PAGE_MASK))
+		return -EINVAL;
+
+	if (unlikely(((__u32) -1) - pin->offset < pin->len))
+		return -EINVAL;
+
+	if (unlikely(PAGE_ALIGN(asma->size) < pin->offset + pin->len))
+		return -EINVAL;
+
+	*pgstart = pin->offset / PAGE_SIZE;
+	*pgend = *pgstart + (pin->len / PAGE_SIZE) - 1;
+
+	return 0;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -585,29 +804,17 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	size_t pgstart, pgend;
 	int ret = -EINVAL;
 
-	if (unlikely(!asma->file))
-		return -EINVAL;
-
 	if (unlikely(copy_from_user(&pin, p, sizeof(pin))))
 		return -EFAULT;
 
-	/* per custom, you can pass zero for len to mean "everything onward" */
-	if (!pin.len)
-		pin.len = PAGE_ALIGN(asma->size) - pin.offset;
-
-	if (unlikely((pin.offset | pin.len) & ~PAGE_MASK))
-		return -EINVAL;
-
-	if (unlikely(((__u32) -1) - pin.offset < pin.len))
-		return -EINVAL;
+	mutex_lock(&asma->mutex);
 
-	if (unlikely(PAGE_ALIGN(asma->size) < pin.offset + pin.len))
-		return -EINVAL;
-
-	pgstart = pin.offset / PAGE_SIZE;
-	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
+	if (unlikely(!asma->file))
+		goto out;
 
-	mutex_lock(&ashmem_mutex);
+	ret = pin_to_pages(asma, &pin, &pgstart, &pgend);
+	if (ret)
+		goto out;
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +828,67 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+out:
+	mutex_unlock(&asma->mutex);
+
+	return ret;
+}
+
+/* ranges copied from userspace per batch of a vectored pin or unpin */
+#define ASHMEM_PIN_BATCH	32
+
+/*
+ * ashmem_pin_unpin_vec - pin or unpin an array of ranges in one call.
+ *
+ * For ASHMEM_PIN_VEC, returns ASHMEM_WAS_PURGED if any of the ranges was
+ * purged.  On error, the ranges before the failing one have been applied.
+ */
+static int ashmem_pin_unpin_vec(struct ashmem_area *asma, unsigned long cmd,
+				void __user *p)
+{
+	struct ashmem_pin_vec vec;
+	struct ashmem_pin pins[ASHMEM_PIN_BATCH];
+	struct ashmem_pin __user *upins;
+	int ret = ASHMEM_NOT_PURGED;
+
+	if (unlikely(copy_from_user(&vec, p, sizeof(vec))))
+		return -EFAULT;
+	if (unlikely(vec.reserved))
+		return -EINVAL;
+	upins = (struct ashmem_pin __user *)(unsigned long)vec.ranges;
+
+	while (vec.count) {
+		unsigned int i, n = min_t(__u32, vec.count, ASHMEM_PIN_BATCH);
+
+		if (unlikely(copy_from_user(pins, upins, n * sizeof(pins[0]))))
+			return -EFAULT;
+
+		mutex_lock(&asma->mutex);
+		if (unlikely(!asma->file)) {
+			mutex_unlock(&asma->mutex);
+			return -EINVAL;
+		}
+		for (i = 0; i < n; i++) {
+			size_t pgstart, pgend;
+			int err;
+
+			err = pin_to_pages(asma, &pins[i], &pgstart, &pgend);
+			if (!err) {
+				if (cmd == ASHMEM_PIN_VEC)
+					ret |= ashmem_pin(asma, pgstart, pgend);
+				else
+					err = ashmem_unpin(asma, pgstart, pgend);
+			}
+			if (err) {
+				mutex_unlock(&asma->mutex);
+				return err;
+			}
+		}
+		mutex_unlock(&asma->mutex);
+
+		upins += n;
+		vec.count -= n;
+	}
 
 	return ret;
 }
@@ -640,10 +907,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -659,6 +928,10 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_pin_unpin(asma, cmd, (void __user *) arg);
 		break;
+	case ASHMEM_PIN_VEC:
+	case ASHMEM_UNPIN_VEC:
+		ret = ashmem_pin_unpin_vec(asma, cmd, (void __user *) arg);
+		break;
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
@@ -669,6 +942,7 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = ashmem_shrink(&ashmem_shrinker, &sc);
 			sc.nr_to_scan = ret;
 			ashmem_shrink(&ashmem_shrinker, &sc);
+			flush_delayed_work(&ashmem_purge_work);
 		}
 		break;
 	}
@@ -676,6 +950,47 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static int ashmem_stats_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_stats stats;
+	unsigned long count;
+
+	spin_lock(&ashmem_lru_lock);
+	stats = ashmem_stats;
+	count = lru_count;
+	spin_unlock(&ashmem_lru_lock);
+
+	seq_printf(m, "lru_pages: %lu\n", count);
+	seq_printf(m, "scans: %lu\n", stats.scans);
+	seq_printf(m, "pages_purged: %lu\n", stats.pages_purged);
+	seq_printf(m, "ranges_deferred: %lu\n", stats.ranges_deferred);
+	seq_printf(m, "areas_skipped: %lu\n", stats.areas_skipped);
+	seq_printf(m, "scan_us: %llu\n",
+		   (unsigned long long)div_u64(stats.scan_ns, NSEC_PER_USEC));
+	seq_printf(m, "scan_us_max: %llu\n",
+		   (unsigned long long)div_u64(stats.scan_ns_max,
+					       NSEC_PER_USEC));
+	seq_printf(m, "work_us: %llu\n",
+		   (unsigned long long)div_u64(stats.work_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int ashmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_stats_show, NULL);
+}
+
+static const struct file_operations ashmem_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = ashmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *ashmem_debugfs_stats;
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -721,6 +1036,10 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs_stats = debugfs_create_file("ashmem_stats", S_IRUGO,
+						   NULL, NULL,
+						   &ashmem_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -730,7 +1049,9 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove(ashmem_debugfs_stats);
 	unregister_shrinker(&ashmem_shrinker);
+	cancel_delayed_work_sync(&ashmem_purge_work);
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
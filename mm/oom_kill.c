@@ -61,6 +61,8 @@ int test_set_oom_score_adj(int new_val)
 		current->signal->oom_score_adj = new_val;
 	}
 	spin_unlock_irq(&sighand->siglock);
+	if (new_val != old_val)
+		oom_adj_notify(OOM_ADJ_CHANGED, current);
 
 	return old_val;
 }
@@ -585,6 +587,31 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+/*
+ * oom_adj notifiers are told when a thread group is created or released
+ * and when its oom_adj is written, so that they can index tasks by
+ * oom_adj instead of walking the task list.  Called in atomic context
+ * with the signal_struct of the task still valid.
+ */
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notify_list);
+
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+void oom_adj_notify(unsigned long event, struct task_struct *p)
+{
+	atomic_notifier_call_chain(&oom_adj_notify_list, event, p);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in
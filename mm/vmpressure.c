@@ -0,0 +1,94 @@
+/*
+ * linux/mm/vmpressure.c
+ *
+ * Reclaim pressure notifications.
+ *
+ * The pressure is the share of scanned pages that reclaim failed to free,
+ * sampled once every vmpressure_win scanned pages.  A pressure close to
+ * 100 means reclaim is scanning without getting anything back, which is
+ * the point where killing a process is cheaper than going on.
+ *
+ * This file is released under the GPLv2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/* scanned pages per sample, the same window the upstream vmpressure uses */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notify_list);
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	unsigned long scanned, reclaimed;
+	unsigned long pressure = 0;
+
+	spin_lock(&vmpressure_lock);
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	if (!scanned)
+		return;
+	/* reclaim can free more pages than it scanned, e.g. THP splits */
+	if (reclaimed < scanned)
+		pressure = 100 - reclaimed * 100 / scanned;
+
+	blocking_notifier_call_chain(&vmpressure_notify_list, pressure, NULL);
+}
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+/**
+ * vmpressure() - account reclaim efficiency
+ * @gfp:	gfp mask of the allocation that caused the reclaim
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called from the reclaim path after each zone pass.  Cheap: it only
+ * adds up the counters and kicks a work item once a window is full.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	bool full;
+
+	/*
+	 * Only allocations that can do IO or use highmem or movable
+	 * memory count, the others cannot reclaim much anyway.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	full = vmpressure_scanned >= vmpressure_win;
+	spin_unlock(&vmpressure_lock);
+
+	if (full)
+		schedule_work(&vmpressure_work);
+}
+
+int vmpressure_notifier_register(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_register);
+
+int vmpressure_notifier_unregister(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_unregister);
@@ -11,8 +11,14 @@
 #define __XT_QTAGUID_INTERNAL_H__
 
 #include <linux/types.h>
+#include <linux/cache.h>
+#include <linux/cpumask.h>
+#include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/string.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 /* Iface handling */
@@ -179,31 +185,54 @@ struct data_counters {
 	struct byte_packet_counters bpc[IFS_MAX_COUNTER_SETS][IFS_MAX_DIRECTIONS][IFS_MAX_PROTOS];
 };
 
+/*
+ * Counters bumped for every packet are kept per cpu, in an array of
+ * nr_cpu_ids slots indexed by smp_processor_id(), and only summed up when
+ * they are read. The match runs with BH disabled, so each slot has a
+ * single writer. The arrays are allocated in atomic context, which rules
+ * out alloc_percpu().
+ */
+struct data_counters_cpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
+struct iface_skb_totals_cpu {
+	struct byte_packet_counters bpc[IFS_MAX_DIRECTIONS];
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
 /* Generic X based nodes used as a base for rb_tree ops */
 struct tag_node {
 	struct rb_node node;
 	tag_t tag;
 };
 
+/* Buckets in an iface_stat's hash of its tag_stats */
+#define TAG_STAT_HASH_BITS 6
+
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
+	/* For lockless lookups from the packet path */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 	/*
 	 * If this tag is acct_tag based, we need to count against the
 	 * matching parent uid_tag.
 	 */
-	struct data_counters *parent_counters;
+	struct tag_stat *parent;
+	struct data_counters_cpu counters[0];	/* nr_cpu_ids slots */
 };
 
 struct iface_stat {
-	struct list_head list;  /* in iface_stat_list */
+	struct list_head list;  /* in iface_stat_list, RCU */
 	char *ifname;
 	bool active;
 	/* net_dev is only valid for active iface_stat */
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct byte_packet_counters totals_via_skb[IFS_MAX_DIRECTIONS];
+	struct iface_skb_totals_cpu *totals_via_skb;	/* nr_cpu_ids slots */
 	/*
 	 * We keep the last_known, because some devices reset their counters
 	 * just before NETDEV_UP, while some will reset just before
@@ -218,10 +247,70 @@ struct iface_stat {
 
 	struct proc_dir_entry *proc_ptr;
 
+	/*
+	 * The tree keeps the tag_stats ordered for the stats file, the hash
+	 * is searched under RCU by the packet path. Both are only changed
+	 * with tag_stat_list_lock held.
+	 */
 	struct rb_root tag_stat_tree;
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
 	spinlock_t tag_stat_list_lock;
 };
 
+static inline void tag_stat_sum_counters(const struct tag_stat *ts,
+					 struct data_counters *sum)
+{
+	int cpu, set, dir, proto;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		const struct data_counters_cpu *slot = &ts->counters[cpu];
+		struct data_counters dc;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&slot->syncp);
+			dc = slot->dc;
+		} while (u64_stats_fetch_retry_bh(&slot->syncp, start));
+
+		for (set = 0; set < IFS_MAX_COUNTER_SETS; set++)
+			for (dir = 0; dir < IFS_MAX_DIRECTIONS; dir++)
+				for (proto = 0; proto < IFS_MAX_PROTOS;
+				     proto++) {
+					struct byte_packet_counters *bpc =
+						&sum->bpc[set][dir][proto];
+					bpc->bytes +=
+						dc.bpc[set][dir][proto].bytes;
+					bpc->packets +=
+						dc.bpc[set][dir][proto].packets;
+				}
+	}
+}
+
+static inline void iface_stat_sum_skb_totals(const struct iface_stat *is,
+				struct byte_packet_counters sum[IFS_MAX_DIRECTIONS])
+{
+	int cpu, dir;
+
+	memset(sum, 0, sizeof(*sum) * IFS_MAX_DIRECTIONS);
+	for_each_possible_cpu(cpu) {
+		const struct iface_skb_totals_cpu *slot =
+			&is->totals_via_skb[cpu];
+		struct byte_packet_counters bpc[IFS_MAX_DIRECTIONS];
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&slot->syncp);
+			memcpy(bpc, slot->bpc, sizeof(bpc));
+		} while (u64_stats_fetch_retry_bh(&slot->syncp, start));
+
+		for (dir = 0; dir < IFS_MAX_DIRECTIONS; dir++) {
+			sum[dir].bytes += bpc[dir].bytes;
+			sum[dir].packets += bpc[dir].packets;
+		}
+	}
+}
+
 /* This is needed to create proc_dir_entries from atomic context. */
 struct iface_stat_work {
 	struct work_struct iface_work;
@@ -236,6 +325,9 @@ struct iface_stat_work {
  */
 struct sock_tag {
 	struct rb_node sock_node;
+	/* In sock_tag_hash, for lockless lookups from the packet path */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 	struct sock *sk;  /* Only used as a number, never dereferenced */
 	/* The socket is needed for sockfd_put() */
 	struct socket *socket;
@@ -281,6 +373,9 @@ struct qtaguid_event_counts {
 /* Track the set active_set for the given tag. */
 struct tag_counter_set {
 	struct tag_node tn;
+	/* In tag_counter_set_hash, for lockless lookups */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 	int active_set;
 };
 
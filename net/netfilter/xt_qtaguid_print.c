@@ -155,6 +155,8 @@ char *pp_tag_stat(struct tag_stat *ts)
 	char *counters_str;
 	char *parent_counters_str;
 	char *res;
+	struct data_counters dc;
+	struct data_counters parent_dc;
 
 	if (!ts) {
 		res = kasprintf(GFP_ATOMIC, "tag_stat@null{}");
@@ -162,8 +164,12 @@ char *pp_tag_stat(struct tag_stat *ts)
 		return res;
 	}
 	tn_str = pp_tag_node(&ts->tn);
-	counters_str = pp_data_counters(&ts->counters, true);
-	parent_counters_str = pp_data_counters(ts->parent_counters, false);
+	tag_stat_sum_counters(ts, &dc);
+	counters_str = pp_data_counters(&dc, true);
+	if (ts->parent)
+		tag_stat_sum_counters(ts->parent, &parent_dc);
+	parent_counters_str = pp_data_counters(
+		ts->parent ? &parent_dc : NULL, false);
 	res = kasprintf(GFP_ATOMIC,
 			"tag_stat@%p{%s, counters=%s, parent_counters=%s}",
 			ts, tn_str, counters_str, parent_counters_str);
@@ -177,9 +183,12 @@ char *pp_tag_stat(struct tag_stat *ts)
 char *pp_iface_stat(struct iface_stat *is)
 {
 	char *res;
+	struct byte_packet_counters skb_totals[IFS_MAX_DIRECTIONS];
+
 	if (!is)
 		res = kasprintf(GFP_ATOMIC, "iface_stat@null{}");
-	else
+	else {
+		iface_stat_sum_skb_totals(is, skb_totals);
 		res = kasprintf(GFP_ATOMIC, "iface_stat@%p{"
 				"list=list_head{...}, "
 				"ifname=%s, "
@@ -206,10 +215,10 @@ char *pp_iface_stat(struct iface_stat *is)
 				is->totals_via_dev[IFS_RX].packets,
 				is->totals_via_dev[IFS_TX].bytes,
 				is->totals_via_dev[IFS_TX].packets,
-				is->totals_via_skb[IFS_RX].bytes,
-				is->totals_via_skb[IFS_RX].packets,
-				is->totals_via_skb[IFS_TX].bytes,
-				is->totals_via_skb[IFS_TX].packets,
+				skb_totals[IFS_RX].bytes,
+				skb_totals[IFS_RX].packets,
+				skb_totals[IFS_TX].bytes,
+				skb_totals[IFS_TX].packets,
 				is->last_known_valid,
 				is->last_known[IFS_RX].bytes,
 				is->last_known[IFS_RX].packets,
@@ -218,6 +227,7 @@ char *pp_iface_stat(struct iface_stat *is)
 				is->active,
 				is->net_dev,
 				is->proc_ptr);
+	}
 	_bug_on_err_or_null(res);
 	return res;
 }